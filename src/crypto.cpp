@@ -0,0 +1,222 @@
+#include "crypto.h"
+
+#if !defined(ARDUINO_ARCH_ESP32)
+#include <time.h>
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+// ================== MBEDTLS (HARDWARE AES) ==================
+FrameCipher::FrameCipher() { mbedtls_ccm_init(&ctx); }
+FrameCipher::~FrameCipher() { mbedtls_ccm_free(&ctx); }
+
+void FrameCipher::setKey(const uint8_t key[CRYPTO_KEY_LEN]) {
+    keyed = mbedtls_ccm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, CRYPTO_KEY_LEN * 8) == 0;
+}
+
+void FrameCipher::clearKey() {
+    mbedtls_ccm_free(&ctx);
+    mbedtls_ccm_init(&ctx);
+    keyed = false;
+}
+
+void FrameCipher::seal(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+                       uint8_t *buf, size_t len, uint8_t *tag) {
+    mbedtls_ccm_encrypt_and_tag(&ctx, len, nonce, CRYPTO_NONCE_LEN, aad, aad_len,
+                                buf, buf, tag, CRYPTO_TAG_LEN);
+}
+
+bool FrameCipher::open(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+                       uint8_t *buf, size_t len, const uint8_t *tag) {
+    return mbedtls_ccm_auth_decrypt(&ctx, len, nonce, CRYPTO_NONCE_LEN, aad, aad_len,
+                                    buf, buf, tag, CRYPTO_TAG_LEN) == 0;
+}
+
+static unsigned long benchMicros() { return micros(); }
+
+#else
+
+// ================== PORTABLE AES-128 ==================
+// Encryption direction only; CCM never runs the inverse cipher.
+static const uint8_t SBOX[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t xtime(uint8_t x) { return (x << 1) ^ ((x & 0x80) ? 0x1b : 0); }
+
+FrameCipher::FrameCipher() {}
+FrameCipher::~FrameCipher() { clearKey(); }
+
+void FrameCipher::setKey(const uint8_t key[CRYPTO_KEY_LEN]) {
+    memcpy(round_keys, key, 16);
+    uint8_t rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+        uint8_t t[4];
+        memcpy(t, round_keys + i - 4, 4);
+        if (i % 16 == 0) {
+            uint8_t first = t[0];
+            t[0] = SBOX[t[1]] ^ rcon;
+            t[1] = SBOX[t[2]];
+            t[2] = SBOX[t[3]];
+            t[3] = SBOX[first];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++) round_keys[i + j] = round_keys[i - 16 + j] ^ t[j];
+    }
+    keyed = true;
+}
+
+void FrameCipher::clearKey() {
+    memset(round_keys, 0, sizeof(round_keys));
+    keyed = false;
+}
+
+void FrameCipher::encryptBlock(uint8_t s[16]) const {
+    for (int i = 0; i < 16; i++) s[i] ^= round_keys[i];
+    for (int round = 1; round <= 10; round++) {
+        // SubBytes and ShiftRows; the state is column-major, s[row + 4 * col].
+        uint8_t t[16];
+        for (int col = 0; col < 4; col++) {
+            for (int row = 0; row < 4; row++) t[row + 4 * col] = SBOX[s[row + 4 * ((col + row) % 4)]];
+        }
+        if (round < 10) {
+            for (int col = 0; col < 4; col++) {
+                uint8_t *c = t + 4 * col;
+                uint8_t all = c[0] ^ c[1] ^ c[2] ^ c[3];
+                uint8_t first = c[0];
+                c[0] ^= all ^ xtime(c[0] ^ c[1]);
+                c[1] ^= all ^ xtime(c[1] ^ c[2]);
+                c[2] ^= all ^ xtime(c[2] ^ c[3]);
+                c[3] ^= all ^ xtime(c[3] ^ first);
+            }
+        }
+        for (int i = 0; i < 16; i++) s[i] = t[i] ^ round_keys[16 * round + i];
+    }
+}
+
+// ================== PORTABLE CCM ==================
+// One pass per block: the CBC-MAC runs over the plaintext, so encryption
+// MACs then XORs the keystream and decryption does the reverse. Returns the
+// full-length tag, already masked with S0.
+void FrameCipher::ccm(bool encrypt, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                      uint8_t *buf, size_t len, uint8_t mac[16]) const {
+    uint8_t x[16];
+    x[0] = (aad_len ? 0x40 : 0) | ((CRYPTO_TAG_LEN - 2) / 2) << 3 | 1;  // L = 2
+    memcpy(x + 1, nonce, CRYPTO_NONCE_LEN);
+    x[14] = len >> 8;
+    x[15] = len & 0xFF;
+    encryptBlock(x);
+
+    if (aad_len) {
+        x[0] ^= aad_len >> 8;
+        x[1] ^= aad_len & 0xFF;
+        size_t pos = 2;
+        for (size_t i = 0; i < aad_len; i++) {
+            x[pos++] ^= aad[i];
+            if (pos == 16) {
+                encryptBlock(x);
+                pos = 0;
+            }
+        }
+        if (pos) encryptBlock(x);
+    }
+
+    uint8_t ctr[16], s[16];
+    ctr[0] = 1;
+    memcpy(ctr + 1, nonce, CRYPTO_NONCE_LEN);
+    for (size_t off = 0, block = 1; off < len; off += 16, block++) {
+        size_t n = min((size_t)16, len - off);
+        ctr[14] = block >> 8;
+        ctr[15] = block & 0xFF;
+        memcpy(s, ctr, 16);
+        encryptBlock(s);
+        if (encrypt) {
+            for (size_t i = 0; i < n; i++) x[i] ^= buf[off + i];
+            for (size_t i = 0; i < n; i++) buf[off + i] ^= s[i];
+        } else {
+            for (size_t i = 0; i < n; i++) buf[off + i] ^= s[i];
+            for (size_t i = 0; i < n; i++) x[i] ^= buf[off + i];
+        }
+        encryptBlock(x);
+    }
+
+    ctr[14] = ctr[15] = 0;
+    memcpy(s, ctr, 16);
+    encryptBlock(s);
+    for (int i = 0; i < 16; i++) mac[i] = x[i] ^ s[i];
+}
+
+void FrameCipher::seal(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+                       uint8_t *buf, size_t len, uint8_t *tag) {
+    uint8_t mac[16];
+    ccm(true, nonce, aad, aad_len, buf, len, mac);
+    memcpy(tag, mac, CRYPTO_TAG_LEN);
+}
+
+bool FrameCipher::open(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+                       uint8_t *buf, size_t len, const uint8_t *tag) {
+    uint8_t mac[16];
+    ccm(false, nonce, aad, aad_len, buf, len, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < CRYPTO_TAG_LEN; i++) diff |= mac[i] ^ tag[i];
+    return diff == 0;
+}
+
+// micros() is virtual time in the replay harness; use the real clock.
+static unsigned long benchMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+#endif
+
+// ================== BENCHMARK ==================
+void cryptoBenchmark() {
+    static const int sizes[] = {32, 128, 240};
+    const int rounds = 200;
+    uint8_t key[CRYPTO_KEY_LEN], nonce[CRYPTO_NONCE_LEN] = {}, aad[10] = {}, buf[256], tag[CRYPTO_TAG_LEN];
+    for (int i = 0; i < CRYPTO_KEY_LEN; i++) key[i] = i;
+    for (int i = 0; i < (int)sizeof(buf); i++) buf[i] = i;
+
+    FrameCipher cipher;
+    cipher.setKey(key);
+    Serial.println("\n[DBG]========== AES-128-CCM (us/frame) ==========");
+    for (int size : sizes) {
+        unsigned long start = benchMicros();
+        for (int i = 0; i < rounds; i++) {
+            nonce[12] = i;
+            cipher.seal(nonce, aad, sizeof(aad), buf, size, tag);
+        }
+        unsigned long sealed = benchMicros() - start;
+
+        start = benchMicros();
+        bool ok = true;
+        for (int i = 0; i < rounds; i++) {
+            nonce[12] = i;
+            cipher.seal(nonce, aad, sizeof(aad), buf, size, tag);
+            ok &= cipher.open(nonce, aad, sizeof(aad), buf, size, tag);
+        }
+        unsigned long roundTrip = benchMicros() - start;
+
+        Serial.println("[DBG]" + String(size) + " B | seal: " + String(sealed / (float)rounds, 1) +
+                       " | open: " + String((roundTrip - sealed) / (float)rounds, 1) +
+                       (ok ? "" : " | VERIFY FAILED"));
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <mbedtls/ccm.h>
+#endif
+
+// ================== FRAME CIPHER ==================
+// AES-128-CCM (RFC 3610) with a 13-byte nonce and a truncated tag, working in
+// place on the caller's buffer. ESP32 builds go through mbedTLS, which drives
+// the hardware AES block; host builds use the portable AES in crypto.cpp.
+
+#define CRYPTO_KEY_LEN      16
+#define CRYPTO_NONCE_LEN    13
+#ifndef CRYPTO_TAG_LEN
+#define CRYPTO_TAG_LEN      4       // CCM allows 4..16 in steps of 2; 4 is what LoRaWAN spends
+#endif
+
+class FrameCipher {
+public:
+    FrameCipher();
+    ~FrameCipher();
+    FrameCipher(const FrameCipher &) = delete;
+    FrameCipher &operator=(const FrameCipher &) = delete;
+
+    void setKey(const uint8_t key[CRYPTO_KEY_LEN]);
+    void clearKey();
+    bool hasKey() const { return keyed; }
+
+    // Encrypts buf in place and writes CRYPTO_TAG_LEN bytes of tag. aad is
+    // authenticated but not encrypted.
+    void seal(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+              uint8_t *buf, size_t len, uint8_t *tag);
+    // Decrypts buf in place; false if the tag does not match, in which case
+    // buf holds garbage and must be dropped.
+    bool open(const uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *aad, size_t aad_len,
+              uint8_t *buf, size_t len, const uint8_t *tag);
+
+private:
+    bool keyed = false;
+#if defined(ARDUINO_ARCH_ESP32)
+    mbedtls_ccm_context ctx;
+#else
+    uint8_t round_keys[176];
+    void encryptBlock(uint8_t block[16]) const;
+    void ccm(bool encrypt, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+             uint8_t *buf, size_t len, uint8_t mac[16]) const;
+#endif
+};
+
+// Times seal and open over a few frame sizes and prints us per frame.
+void cryptoBenchmark();
@@ -0,0 +1,129 @@
+#include "heapGuard.h"
+
+#if defined(HEAP_GUARD)
+
+#include "loopMonitor.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_rom_sys.h>
+
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc (see env:heapguard).
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+}
+
+static TaskHandle_t guardedTask = nullptr;
+
+static bool onGuardedTask() { return guardedTask && xTaskGetCurrentTaskHandle() == guardedTask; }
+static void heapGuardDisarm() { guardedTask = nullptr; }
+#define HEAP_GUARD_PRINTF esp_rom_printf
+#else
+#include <cstdio>
+
+// The host build is single threaded; the replay harness's operator new calls
+// heapGuardOnAlloc().
+static bool guardArmed = false;
+
+static bool onGuardedTask() { return guardArmed; }
+static void heapGuardDisarm() { guardArmed = false; }
+#define HEAP_GUARD_PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+struct HeapSite {
+    const char *section;
+    unsigned long count;
+    unsigned long bytes;
+};
+
+static int heapFreeDepth = 0;
+static HeapSite sites[HEAP_GUARD_MAX_SITES];
+static int siteCount = 0;
+static unsigned long allocations = 0;
+static unsigned long allocatedBytes = 0;
+static unsigned long freeScopeAllocations = 0;
+
+// Runs inside malloc, so nothing here may allocate: no String, no Serial.
+static void heapGuardCheck(size_t size) {
+    if (!onGuardedTask()) return;
+    LoopSection *current = loopMonitor().current;
+    const char *section = current ? current->name : "loop";
+
+    if (heapFreeDepth > 0) {
+#ifdef HEAP_GUARD_STRICT
+        HEAP_GUARD_PRINTF("[ERR] %u byte heap allocation in heap-free scope of %s\n", (unsigned)size, section);
+        abort();
+#endif
+        freeScopeAllocations++;
+    }
+
+    allocations++;
+    allocatedBytes += size;
+    for (int i = 0; i < siteCount; i++) {
+        if (strcmp(sites[i].section, section) == 0) {
+            sites[i].count++;
+            sites[i].bytes += size;
+            return;
+        }
+    }
+    if (siteCount < HEAP_GUARD_MAX_SITES) sites[siteCount++] = {section, 1, size};
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+extern "C" {
+void *__wrap_malloc(size_t size) {
+    heapGuardCheck(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    heapGuardCheck(count * size);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (size) heapGuardCheck(size);
+    return __real_realloc(ptr, size);
+}
+}
+
+void heapGuardOnAlloc(size_t) {}
+
+void heapGuardArm() {
+    guardedTask = xTaskGetCurrentTaskHandle();
+}
+#else
+void heapGuardOnAlloc(size_t size) { heapGuardCheck(size); }
+
+void heapGuardArm() {
+    guardArmed = true;
+}
+#endif
+
+HeapFreeScope::HeapFreeScope() { heapFreeDepth++; }
+HeapFreeScope::~HeapFreeScope() { heapFreeDepth--; }
+
+void heapGuardReport() {
+    // Printing allocates; keep the report out of its own numbers.
+    bool armed = onGuardedTask();
+    heapGuardDisarm();
+    Serial.println("[DBG]Allocations after setup: " + String(allocations) +
+                   " | bytes: " + String(allocatedBytes) +
+                   " | in heap-free scopes: " + String(freeScopeAllocations));
+    for (int i = 0; i < siteCount; i++) {
+        Serial.println(String("[DBG]  ") + sites[i].section +
+                       " | n: " + String(sites[i].count) +
+                       " | bytes: " + String(sites[i].bytes));
+    }
+    if (armed) heapGuardArm();
+}
+
+void heapGuardReset() {
+    siteCount = 0;
+    allocations = 0;
+    allocatedBytes = 0;
+    freeScopeAllocations = 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ================== HEAP GUARD ==================
+// Heap figures for every build, plus an allocation guard for -DHEAP_GUARD
+// builds (pio run -e heapguard, or the replay harness). On the ESP32 the guard
+// wraps malloc/calloc/realloc at link time; in the replay build it hooks the
+// harness's operator new. Once heapGuardArm() runs at the end of setup(), every
+// allocation made from the loop task is counted against the LOOP_SECTION that
+// was active.
+//
+// HEAP_FREE_SCOPE() marks the hot code that must not allocate at all: the
+// radio FIFO fill on TX, the SPI drain and header parse on RX, and the serial
+// write of a received packet. Allocations inside one are counted separately;
+// with -DHEAP_GUARD_STRICT the guard aborts on the first one with the section
+// name. Strict mode covers only those scopes. The rest of loop() still builds
+// Strings (ParsedPacket, routing, logging) and is only counted.
+
+#define HEAP_GUARD_MAX_SITES 12
+
+struct HeapInfo {
+    size_t total;
+    size_t free;
+    size_t min_free;        // low-water mark since boot
+    size_t largest_free;    // biggest block malloc can still hand out
+};
+
+inline HeapInfo heapInfo() {
+#if defined(ARDUINO_ARCH_ESP32)
+    return {ESP.getHeapSize(), ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap()};
+#else
+    return {};
+#endif
+}
+
+#if defined(HEAP_GUARD)
+
+void heapGuardArm();
+void heapGuardReport();
+void heapGuardReset();
+void heapGuardOnAlloc(size_t size);     // allocator hook for host builds
+
+struct HeapFreeScope {
+    HeapFreeScope();
+    ~HeapFreeScope();
+};
+
+#define HEAP_GUARD_CONCAT2(a, b) a##b
+#define HEAP_GUARD_CONCAT(a, b) HEAP_GUARD_CONCAT2(a, b)
+#define HEAP_FREE_SCOPE() HeapFreeScope HEAP_GUARD_CONCAT(_heap_free_, __LINE__)
+
+#else
+
+#define HEAP_FREE_SCOPE() do {} while (0)
+
+inline void heapGuardArm() {}
+inline void heapGuardReport() { Serial.println("[DBG]Heap guard not compiled in, build with -DHEAP_GUARD"); }
+inline void heapGuardReset() {}
+
+#endif
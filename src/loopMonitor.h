@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ================== LOOP STALL MONITOR ==================
+// Always-on watchdog for loop() latency. LOOP_ITERATION at the top of loop()
+// times every pass; LOOP_SECTION marks the code that runs inside it. A pass
+// longer than the loop budget is a stall and is blamed on the section with
+// the most exclusive time in that pass. RX service latency (DIO0 interrupt to
+// the loop picking the frame up) is checked against its own budget. Both go
+// into log2 histograms, and stalls are aggregated into a worst-offenders list.
+// The cost is two micros() calls per pass and per section.
+
+#define LOOP_BUDGET_US      50000   // default loop-pass budget
+#define RX_BUDGET_US        50000   // default DIO0-to-service budget
+#define LOOP_HIST_BUCKETS   25      // 1 us .. 16 s in powers of two
+#define LOOP_MAX_OFFENDERS  12
+#define STALL_LOG_INTERVAL  5000    // ms between stall warnings on serial
+
+struct LatencyHistogram {
+    uint32_t count;
+    uint32_t over_budget;
+    uint32_t max;
+    uint32_t buckets[LOOP_HIST_BUCKETS];
+};
+
+struct StallOffender {
+    const char *section;
+    uint32_t stalls;
+    uint32_t worst_us;
+    uint64_t total_us;
+};
+
+struct LoopSection;
+
+// Frames overwritten before the loop got to them. Counted by the DIO0 ISR,
+// so it is a plain volatile global (data, hence DRAM, on the ESP32) rather
+// than a field of the lazily constructed monitor.
+extern volatile uint32_t loopRxOverruns;
+
+struct LoopMonitor {
+    uint32_t loop_budget;
+    uint32_t rx_budget;
+    LatencyHistogram loop_hist;
+    LatencyHistogram rx_hist;
+    StallOffender offenders[LOOP_MAX_OFFENDERS];
+    int offender_count;
+
+    // Current pass
+    uint32_t pass_start;
+    LoopSection *current;
+    const char *worst_section;
+    uint32_t worst_exclusive;
+    unsigned long last_warning;
+};
+
+inline LoopMonitor loopMonitorInit(uint32_t loop_budget, uint32_t rx_budget) {
+    LoopMonitor m = {};
+    m.loop_budget = loop_budget;
+    m.rx_budget = rx_budget;
+    m.worst_section = "loop";
+    return m;
+}
+
+inline LoopMonitor &loopMonitor() {
+    static LoopMonitor monitor = loopMonitorInit(LOOP_BUDGET_US, RX_BUDGET_US);
+    return monitor;
+}
+
+inline void loopHistRecord(LatencyHistogram &hist, uint32_t us, uint32_t budget) {
+    int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    hist.buckets[min(bucket, LOOP_HIST_BUCKETS - 1)]++;
+    hist.count++;
+    if (us > hist.max) hist.max = us;
+    if (us > budget) hist.over_budget++;
+}
+
+// Tracks exclusive time so a stall is blamed on the innermost slow section.
+struct LoopSection {
+    const char *name;
+    uint32_t start;
+    uint32_t children;
+    LoopSection *parent;
+
+    explicit LoopSection(const char *name) : name(name), start(micros()), children(0) {
+        LoopMonitor &m = loopMonitor();
+        parent = m.current;
+        m.current = this;
+    }
+
+    ~LoopSection() {
+        LoopMonitor &m = loopMonitor();
+        uint32_t total = micros() - start;
+        uint32_t exclusive = total - children;
+        if (parent) parent->children += total;
+        m.current = parent;
+        if (exclusive > m.worst_exclusive) {
+            m.worst_exclusive = exclusive;
+            m.worst_section = name;
+        }
+    }
+};
+
+inline void loopRecordStall(const char *section, uint32_t us) {
+    LoopMonitor &m = loopMonitor();
+    StallOffender *slot = nullptr;
+    for (int i = 0; i < m.offender_count; i++) {
+        if (strcmp(m.offenders[i].section, section) == 0) slot = &m.offenders[i];
+    }
+    if (!slot && m.offender_count < LOOP_MAX_OFFENDERS) {
+        slot = &m.offenders[m.offender_count++];
+        *slot = {section, 0, 0, 0};
+    }
+    if (slot) {
+        slot->stalls++;
+        slot->total_us += us;
+        if (us > slot->worst_us) slot->worst_us = us;
+    }
+
+    if (millis() - m.last_warning >= STALL_LOG_INTERVAL) {
+        m.last_warning = millis();
+        Serial.println(String("\033[33m[WARN]\033[0m Loop stalled ") + String(us / 1000.0, 1) +
+                       " ms in " + section);
+    }
+}
+
+struct LoopIteration {
+    LoopIteration() {
+        LoopMonitor &m = loopMonitor();
+        m.pass_start = micros();
+        m.current = nullptr;
+        m.worst_section = "loop";
+        m.worst_exclusive = 0;
+    }
+
+    ~LoopIteration() {
+        LoopMonitor &m = loopMonitor();
+        uint32_t us = micros() - m.pass_start;
+        loopHistRecord(m.loop_hist, us, m.loop_budget);
+        if (us > m.loop_budget) loopRecordStall(m.worst_section, us);
+    }
+};
+
+// Called when the loop picks up a frame the DIO0 interrupt flagged.
+inline void loopRecordRx(unsigned long irqMicros) {
+    LoopMonitor &m = loopMonitor();
+    uint32_t us = micros() - irqMicros;
+    loopHistRecord(m.rx_hist, us, m.rx_budget);
+}
+
+#define LOOP_CONCAT2(a, b) a##b
+#define LOOP_CONCAT(a, b) LOOP_CONCAT2(a, b)
+#define LOOP_ITERATION() LoopIteration LOOP_CONCAT(_loop_, __LINE__)
+#define LOOP_SECTION(name) LoopSection LOOP_CONCAT(_section_, __LINE__)(name)
+
+inline void loopPrintHistogram(const char *title, const LatencyHistogram &hist, uint32_t budget) {
+    Serial.println(String("[DBG]") + title + ": n " + String((unsigned long)hist.count) +
+                   " | over " + String(budget / 1000.0, 1) + " ms: " + String((unsigned long)hist.over_budget) +
+                   " | max " + String(hist.max / 1000.0, 1) + " ms");
+    for (int b = 0; b < LOOP_HIST_BUCKETS; b++) {
+        if (hist.buckets[b] == 0) continue;
+        uint32_t high = (1UL << b) - 1;
+        String bar;
+        uint32_t width = (uint64_t)hist.buckets[b] * 40 / max(hist.count, 1U);
+        for (uint32_t i = 0; i < max(width, 1U); i++) bar += '#';
+        Serial.println("[DBG]  <= " + String((unsigned long)high) + " us: " +
+                       String((unsigned long)hist.buckets[b]) + " " + bar);
+    }
+}
+
+inline void loopMonitorDump() {
+    LoopMonitor &m = loopMonitor();
+    Serial.println("\n[DBG]========== LOOP MONITOR ==========");
+    loopPrintHistogram("Loop pass", m.loop_hist, m.loop_budget);
+    loopPrintHistogram("RX service", m.rx_hist, m.rx_budget);
+    Serial.println("[DBG]RX overruns: " + String((unsigned long)loopRxOverruns));
+
+    // Worst offenders, longest single stall first. An insertion sort is
+    // plenty for LOOP_MAX_OFFENDERS entries.
+    int count = min(m.offender_count, LOOP_MAX_OFFENDERS);
+    int order[LOOP_MAX_OFFENDERS];
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        while (j > 0 && m.offenders[order[j - 1]].worst_us < m.offenders[i].worst_us) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    for (int i = 0; i < count; i++) {
+        const StallOffender &o = m.offenders[order[i]];
+        Serial.println(String("[DBG]Stall: ") + o.section +
+                       " | count: " + String((unsigned long)o.stalls) +
+                       " | worst: " + String(o.worst_us / 1000.0, 1) + " ms" +
+                       " | avg: " + String(o.total_us / 1000.0 / o.stalls, 1) + " ms");
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
+
+inline void loopMonitorReset() {
+    LoopMonitor &m = loopMonitor();
+    uint32_t loop_budget = m.loop_budget, rx_budget = m.rx_budget;
+    LoopSection *current = m.current;
+    uint32_t pass_start = m.pass_start;
+    m = loopMonitorInit(loop_budget, rx_budget);
+    m.current = current;
+    m.pass_start = pass_start;
+    loopRxOverruns = 0;
+}
@@ -1,6 +1,9 @@
 #include <Arduino.h>
 #include <LoRa.h>
 #include "radio.h"
+#include "profiler.h"
+#include "loopMonitor.h"
+#include "heapGuard.h"
 
 // ================== NODE SETUP ==================
 LoRaNode node("02", 7);
@@ -14,13 +17,21 @@ LoRaNode node("02", 7);
 // ================== ISR FLAGS ==================
 volatile bool hasLoRaPacket = false;
 volatile int lastPacketSize = 0;
+volatile unsigned long lastPacketMicros = 0;
+volatile uint32_t loopRxOverruns = 0;
 
+// Only the timestamp is taken here; RSSI/SNR are read from the loop before the FIFO.
 void IRAM_ATTR onLoRaEvent(int packetSize) {
+    if (hasLoRaPacket) loopRxOverruns++;
+    lastPacketMicros = micros();
     lastPacketSize = packetSize;
     hasLoRaPacket = true;
 }
 
 // ================== SERIAL PARSER ==================
+// The host's timestamp field is dropped: its clock is not the mesh clock, and
+// receivers measure latency from the origin stamp. Frames from the host are
+// stamped with meshTime() when they go out, like our own.
 ParsedPacket parseSerialPacket(String line) {
     ParsedPacket pkt;
     pkt.valid = false;
@@ -42,7 +53,6 @@ ParsedPacket parseSerialPacket(String line) {
 
     if (index < 8) return pkt;
 
-    pkt.timestamp_hex = parts[0];
     pkt.channel_name  = parts[1];
     pkt.channel_id    = parts[2];
     pkt.sender        = parts[3];
@@ -54,10 +64,160 @@ ParsedPacket parseSerialPacket(String line) {
     return pkt;
 }
 
+// ================== MESH KEY ==================
+// 32 hex digits -> 16 key bytes.
+bool parseKey(const String &hex, uint8_t key[CRYPTO_KEY_LEN]) {
+    if (hex.length() != 2 * CRYPTO_KEY_LEN) return false;
+    for (int i = 0; i < CRYPTO_KEY_LEN; i++) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end;
+        key[i] = strtoul(byte, &end, 16);
+        if (*end != '\0') return false;
+    }
+    return true;
+}
+
+// ================== SERIAL COMMANDS ==================
+// Lines starting with '!' are local commands rather than packets to send.
+void handleCommand(const String &line) {
+    if (line == "!stats") {
+        node.printStats();
+    } else if (line == "!routes") {
+        node.printRoutingTable();
+    } else if (line == "!neighbors") {
+        node.printNeighborTable();
+    } else if (line == "!heap") {
+        node.printMemory();
+    } else if (line == "!heap reset") {
+        heapGuardReset();
+        INFO("Heap guard counters cleared");
+    } else if (line == "!balance on" || line == "!balance off") {
+        node.setLoadBalancing(line.endsWith("on"));
+        INFO("Multipath load balancing " + String(line.endsWith("on") ? "enabled" : "disabled"));
+    } else if (line == "!routing aodv" || line == "!routing flood" || line == "!routing collect") {
+        node.setRouting(line.endsWith("aodv") ? ROUTING_AODV : line.endsWith("flood") ? ROUTING_FLOOD : ROUTING_COLLECT);
+    } else if (line == "!sink on" || line == "!sink off") {
+        node.setCollectionSink(line.endsWith("on"));
+    } else if (line == "!routing") {
+        INFO(String("Routing engine: ") + node.routing().name());
+    } else if (line == "!learn on" || line == "!learn off") {
+        node.setRouteLearning(line.endsWith("on"));
+        INFO("Route learning from overheard frames " + String(line.endsWith("on") ? "enabled" : "disabled"));
+    } else if (line == "!gratuitous on" || line == "!gratuitous off") {
+        node.setGratuitousRREP(line.endsWith("on"));
+        INFO("Gratuitous RREP " + String(line.endsWith("on") ? "enabled" : "disabled"));
+    } else if (line.startsWith("!channels ")) {
+        if (!node.setChannels(line.substring(10).toInt())) {
+            WARN("Usage: !channels 1.." + String(MC_MAX_CHANNELS));
+        } else if (node.channels() == 1) {
+            INFO("Multi-channel disabled");
+        }
+    } else if (line == "!power on" || line == "!power off") {
+        node.setAdaptivePower(line.endsWith("on"));
+        INFO("Per-link TX power " + String(line.endsWith("on") ? "enabled" : "disabled"));
+    } else if (line == "!acks on" || line == "!acks off") {
+        node.setHopAcks(line.endsWith("on"));
+        INFO("Hop-by-hop ACKs " + String(line.endsWith("on") ? "enabled" : "disabled"));
+    } else if (line.startsWith("!bulk ") || line.startsWith("!bulkfec ")) {
+        // !bulk <dest> <data> streams data with block ACKs; !bulkfec adds fountain repair
+        int start = line.indexOf(' ') + 1;
+        int sep = line.indexOf(' ', start);
+        if (sep == -1) {
+            WARN("Usage: !bulk <dest> <data>");
+            return;
+        }
+        node.startBulkTransfer(line.substring(start, sep), line.substring(sep + 1), line.startsWith("!bulkfec"));
+    } else if (line == "!capture rx" || line == "!capture all" || line == "!capture off") {
+        // Binary capture records go out on this serial port; see tools/capture2pcap.py
+        node.setCapture(!line.endsWith("off"), line.endsWith("all"));
+        INFO("Frame capture " + line.substring(9));
+    } else if (line == "!prof") {
+        profileDump();
+    } else if (line == "!prof reset") {
+        profileReset();
+        INFO("Profile counters cleared");
+    } else if (line == "!key off") {
+        node.setKey(nullptr);
+    } else if (line.startsWith("!key ")) {
+        // Same key on every node; see SECURE_FRAME_MARKER in radio.h for the frame layout.
+        uint8_t key[CRYPTO_KEY_LEN];
+        if (!parseKey(line.substring(5), key)) {
+            WARN("Usage: !key <32 hex digits> | !key off");
+            return;
+        }
+        node.setKey(key);
+    } else if (line == "!bench crypto") {
+        cryptoBenchmark();
+    } else if (line == "!stalls") {
+        loopMonitorDump();
+    } else if (line == "!stalls reset") {
+        loopMonitorReset();
+        INFO("Loop monitor cleared");
+    } else if (line.startsWith("!slo ")) {
+        // !slo <loop_ms> [rx_ms]
+        int space = line.indexOf(' ', 5);
+        long loop_ms = line.substring(5, space < 0 ? line.length() : space).toInt();
+        long rx_ms = space < 0 ? loop_ms : line.substring(space + 1).toInt();
+        if (loop_ms <= 0 || rx_ms <= 0) {
+            WARN("Usage: !slo <loop_ms> [rx_ms]");
+            return;
+        }
+        loopMonitor().loop_budget = loop_ms * 1000;
+        loopMonitor().rx_budget = rx_ms * 1000;
+        INFO("Latency budget: loop " + String(loop_ms) + " ms, RX " + String(rx_ms) + " ms");
+    } else if (line == "!gen off") {
+        node.setMessageInterval(0);
+        INFO("Traffic generator stopped");
+    } else if (line.startsWith("!gen ")) {
+        // !gen <dest[,dest..]|FF|*> <interval_ms> <size> [constant|poisson|burst:<n>]
+        String args[4];
+        int count = 0, pos = 5;
+        while (count < 4 && pos < (int)line.length()) {
+            int sep = line.indexOf(' ', pos);
+            if (sep == -1) sep = line.length();
+            if (sep > pos) args[count++] = line.substring(pos, sep);
+            pos = sep + 1;
+        }
+        if (count < 3) {
+            WARN("Usage: !gen <dest[,dest..]|FF|*> <interval_ms> <size> [constant|poisson|burst:<n>]");
+            return;
+        }
+        uint8_t pattern = TRAFFIC_CONSTANT;
+        int burst = 1;
+        if (args[3] == "poisson") {
+            pattern = TRAFFIC_POISSON;
+        } else if (args[3].startsWith("burst")) {
+            pattern = TRAFFIC_BURST;
+            burst = args[3].indexOf(':') == -1 ? 4 : args[3].substring(args[3].indexOf(':') + 1).toInt();
+        }
+        node.startTraffic(args[0], args[1].toInt(), args[2].toInt(), pattern, burst);
+    } else if (line == "!traffic") {
+        node.printTraffic();
+    } else if (line == "!traffic reset") {
+        node.resetTrafficSink();
+        INFO("Traffic sink counters cleared");
+    } else if (line == "!trace off") {
+        node.setTraceInterval("", 0);
+        INFO("Periodic trace stopped");
+    } else if (line.startsWith("!trace ")) {
+        // !trace <dest> probes once; !trace <dest> <seconds> repeats the probe
+        String args = line.substring(7);
+        int sep = args.indexOf(' ');
+        if (sep == -1) {
+            node.sendTrace(args);
+        } else {
+            node.setTraceInterval(args.substring(0, sep), args.substring(sep + 1).toInt() * 1000UL);
+        }
+    } else {
+        WARN("Unknown command: " + line);
+    }
+}
+
 // ================== SETUP ==================
 unsigned long lastHeartbeat = 0;
 
 void setup() {
+    Serial.setRxBufferSize(FRAG_MAX_MESSAGE + 256);  // whole fragmented messages arrive as one line
     Serial.begin(115200);
     while (!Serial) {}
 
@@ -71,18 +231,49 @@ void setup() {
     INFO("LoRa init success.");
     LoRa.onReceive(onLoRaEvent);
     LoRa.receive();
+
+#ifdef LOADGEN_DEST
+    // Unattended load generator (env:loadgen); !gen overrides it at runtime.
+    node.startTraffic(LOADGEN_DEST, LOADGEN_INTERVAL, LOADGEN_SIZE, LOADGEN_PATTERN, LOADGEN_BURST);
+#endif
+
+#ifdef COLLECT_SINK
+    node.setCollectionSink(true);
+#endif
+
+#ifdef MESH_KEY
+    uint8_t key[CRYPTO_KEY_LEN];
+    if (parseKey(MESH_KEY, key)) node.setKey(key);
+    else ERR("MESH_KEY must be 32 hex digits");
+#endif
+
+    heapGuardArm();
 }
 
 // ================== MAIN LOOP ==================
 void loop() {
+    LOOP_ITERATION();
+
     // ------------------ SERIAL → LORA ------------------
     if (Serial.available()) {
-        String line = Serial.readStringUntil('\n');
+        LOOP_SECTION("serial.in");
+        PROFILE_SCOPE("bridge.serial_to_lora");
+        String line;
+        {
+            // Blocks for up to the Serial timeout when a line arrives without '\n'.
+            LOOP_SECTION("serial.read");
+            line = Serial.readStringUntil('\n');
+        }
         line.trim();
         if (line.length() == 0) return;
 
         if (line.startsWith("[") && line.indexOf("]") != -1) return;
 
+        if (line.startsWith("!")) {
+            handleCommand(line);
+            return;
+        }
+
         ParsedPacket pkt = parseSerialPacket(line);
         if (!pkt.valid) {
             WARN("Invalid serial packet discarded.");
@@ -90,8 +281,14 @@ void loop() {
         }
 
         if (pkt.channel_name == "DATA" && pkt.channel_id.length() > 0) {
-            node.sendDataAODV(pkt.channel_id, pkt.message);
-            INFO("AODV TX: " + pkt.message);
+            if (node.sendData(pkt.channel_id, pkt.message)) {
+                INFO(String(node.routing().name()) + " TX: " + pkt.message);
+            } else {
+                WARN(String(node.routing().name()) + " TX failed: " + pkt.message);
+            }
+        } else if (pkt.is_channel) {
+            node.sendChannel(pkt);
+            INFO("Channel TX: " + pkt.message);
         } else {
             node.sendMessage(pkt);
             DBG("Raw TX: " + line);
@@ -101,34 +298,65 @@ void loop() {
 
     // ------------------ LORA → SERIAL ------------------
     if (hasLoRaPacket) {
+        LOOP_SECTION("rx.service");
+        PROFILE_SCOPE("bridge.lora_to_serial");
         hasLoRaPacket = false;
+        loopRecordRx(lastPacketMicros);
 
-        node.processReceived(lastPacketSize);
-        ParsedPacket pkt = node.getLastReceivedPacket();
+        node.processReceived(lastPacketSize, lastPacketMicros);
+        const ParsedPacket &pkt = node.getLastReceivedPacket();
 
         if (pkt.valid) {
-            String out = pkt.timestamp_hex + "||" +
-                         pkt.channel_name + "||" +
-                         pkt.channel_id + "||" +
-                         pkt.sender + "||" +
-                         pkt.message_id + "||" +
-                         String(pkt.length) + "||" +
-                         String(pkt.is_channel ? 1 : 0) + "||" +
-                         pkt.message;
-            Serial.println(out);
-
-            if (pkt.channel_name == "RREQ" || pkt.channel_name == "RREP") {
-                node.receiveAODV(pkt);
-            }
+            PROFILE_SCOPE("bridge.serial_write");
+            HEAP_FREE_SCOPE();
+            printPacket(Serial, pkt);
+            Serial.println();
         }
 
         node.clearLastReceivedPacket();
         LoRa.receive();
     }
 
+    // ------------------ HELLO / LINK MONITOR ------------------
+    {
+        LOOP_SECTION("neighbors");
+        node.refreshNeighbors();
+    }
+    {
+        LOOP_SECTION("channels");
+        node.serviceChannels();
+    }
+    {
+        LOOP_SECTION("routing");
+        node.serviceRouting();
+    }
+    {
+        LOOP_SECTION("ackq");
+        node.serviceAckQueue();
+    }
+    {
+        LOOP_SECTION("frag");
+        node.serviceFragments();
+        node.serviceBulk();
+    }
+    {
+        LOOP_SECTION("traffic");
+        node.serviceTrace();
+        node.serviceTraffic();
+    }
+
     // ------------------ HEARTBEAT ------------------
     if (millis() - lastHeartbeat > 10000) {
+        LOOP_SECTION("heartbeat");
         lastHeartbeat = millis();
-        node.refreshAODVTable();
+        node.refreshRoutes();
+    }
+
+#ifdef LOADGEN_REPORT_MS
+    static unsigned long lastTrafficReport = 0;
+    if (millis() - lastTrafficReport > LOADGEN_REPORT_MS) {
+        lastTrafficReport = millis();
+        node.printTraffic();
     }
+#endif
 }
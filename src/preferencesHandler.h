@@ -1,25 +1,28 @@
 #include <Arduino.h>
 #include <Preferences.h>
+#include "radio.h"
+#include "profiler.h"
 
 
-struct Packet {
-    // PACKET DATA
-    char time_sent[20];
-    char channel_name[16];
-    char channel_id[8];
-    char sender_id[8];
-    char message_id[8];
-    int length;
-    bool is_channel;
-    char message[64];
+#define STORE_RECORD_MAX 512   // bytes per stored packet; longer records are cut short
 
-    // METADATA
-    uint8_t spreading_factor;
-    short rssi;
-    float snr;
-    char time_received[20];
-    float latency_ms;
-    bool valid;
+// Print into a fixed buffer; anything past the end is dropped.
+class RecordPrint : public Print {
+public:
+    RecordPrint(char *buf, size_t size) : buf(buf), size(size) { buf[0] = '\0'; }
+
+    size_t write(uint8_t c) override {
+        if (len + 1 >= size) return 0;
+        buf[len++] = c;
+        buf[len] = '\0';
+        return 1;
+    }
+    using Print::write;
+
+private:
+    char *buf;
+    size_t size;
+    size_t len = 0;
 };
 
 
@@ -36,23 +39,13 @@ String generateUniqueId() {
 }
 
 
-void storePacket(const Packet &pkt) {
-    String packet = String(pkt.time_sent) + "||" +
-                    String(pkt.channel_name) + "||" +
-                    String(pkt.channel_id) + "||" +
-                    String(pkt.sender_id) + "||" +
-                    String(pkt.message_id) + "||" +
-                    String(pkt.length) + "||" +
-                    String(pkt.is_channel ? 1 : 0) + "||" +
-                    String(pkt.message) + "||" +
-                    String(pkt.spreading_factor) + "||" +
-                    String(pkt.rssi) + "||" +
-                    String(pkt.snr) + "||" +
-                    String(pkt.time_received) + "||" +
-                    String(pkt.latency_ms) + "||" +
-                    String(pkt.valid ? 1 : 0);
-                    
-    prefs.putString(("packet_" + generateUniqueId()).c_str(), packet.c_str());
+// Records are the serial bridge line for the packet, see printPacket().
+void storePacket(const ParsedPacket &pkt) {
+    PROFILE_SCOPE("store.packet");
+    static char record[STORE_RECORD_MAX];
+    RecordPrint out(record, sizeof(record));
+    printPacket(out, pkt);
+    prefs.putString(("packet_" + generateUniqueId()).c_str(), record);
 }
 
 void PreferencesHandlerBegin() {
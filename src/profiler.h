@@ -0,0 +1,158 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ================== PROFILING PROBES ==================
+// Scoped timers for the RX/TX hot paths. Build with -DPROFILING to enable
+// them; otherwise PROFILE_SCOPE compiles to nothing. Times come from the
+// CPU cycle counter on the ESP32 and clock_gettime() on host builds, and
+// are inclusive: a probe's time contains every probe nested inside it.
+//
+//   void LoRaNode::sendMessage(...) {
+//       PROFILE_SCOPE("tx.send");
+//       ...
+//   }
+//
+// Each probe keeps count/min/max/total plus a log histogram with 4 buckets
+// per power of two, which bounds the p99 estimate to within 25%.
+
+#define PROFILE_MAX_PROBES  16
+#define PROFILE_SUB_BITS    2
+#define PROFILE_BUCKETS     (32 << PROFILE_SUB_BITS)
+
+#ifdef PROFILING
+
+#if defined(ARDUINO_ARCH_ESP32)
+inline uint32_t profileTicks() { return ESP.getCycleCount(); }
+inline float profileTicksPerUs() { return ESP.getCpuFreqMHz(); }
+#else
+#include <time.h>
+inline uint32_t profileTicks() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+inline float profileTicksPerUs() { return 1000; }
+#endif
+
+struct ProfileProbe {
+    const char *name;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[PROFILE_BUCKETS];
+};
+
+inline ProfileProbe *profileProbes() {
+    static ProfileProbe probes[PROFILE_MAX_PROBES];
+    return probes;
+}
+
+inline int &profileProbeCount() {
+    static int count = 0;
+    return count;
+}
+
+// Looked up once per call site; a full table returns nullptr and the site
+// goes unmeasured.
+inline ProfileProbe *profileProbe(const char *name) {
+    ProfileProbe *probes = profileProbes();
+    int &count = profileProbeCount();
+    for (int i = 0; i < count; i++) {
+        if (strcmp(probes[i].name, name) == 0) return &probes[i];
+    }
+    if (count >= PROFILE_MAX_PROBES) return nullptr;
+    probes[count] = {};
+    probes[count].name = name;
+    probes[count].min = UINT32_MAX;
+    return &probes[count++];
+}
+
+inline int profileBucket(uint32_t ticks) {
+    if (ticks < (1u << PROFILE_SUB_BITS)) return ticks;
+    int octave = 31 - __builtin_clz(ticks);
+    int sub = (ticks >> (octave - PROFILE_SUB_BITS)) & ((1 << PROFILE_SUB_BITS) - 1);
+    return (octave << PROFILE_SUB_BITS) + sub;
+}
+
+inline uint32_t profileBucketLow(int bucket) {
+    if (bucket < (1 << PROFILE_SUB_BITS)) return bucket;
+    int octave = bucket >> PROFILE_SUB_BITS;
+    uint32_t sub = bucket & ((1 << PROFILE_SUB_BITS) - 1);
+    return (1u << octave) + (sub << (octave - PROFILE_SUB_BITS));
+}
+
+inline void profileRecord(ProfileProbe *probe, uint32_t ticks) {
+    probe->count++;
+    probe->total += ticks;
+    if (ticks < probe->min) probe->min = ticks;
+    if (ticks > probe->max) probe->max = ticks;
+    probe->buckets[profileBucket(ticks)]++;
+}
+
+// Upper edge of the bucket holding the given percentile, capped at max.
+inline uint32_t profilePercentile(const ProfileProbe &probe, int pct) {
+    uint32_t target = ((uint64_t)probe.count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += probe.buckets[b];
+        if (seen >= target) {
+            uint32_t high = b + 1 < PROFILE_BUCKETS ? profileBucketLow(b + 1) - 1 : UINT32_MAX;
+            return min(high, probe.max);
+        }
+    }
+    return probe.max;
+}
+
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileProbe *probe) : probe(probe), start(profileTicks()) {}
+    ~ProfileScope() {
+        if (probe) profileRecord(probe, profileTicks() - start);
+    }
+
+private:
+    ProfileProbe *probe;
+    uint32_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) \
+    static ProfileProbe *const PROFILE_CONCAT(_probe_, __LINE__) = profileProbe(name); \
+    ProfileScope PROFILE_CONCAT(_scope_, __LINE__)(PROFILE_CONCAT(_probe_, __LINE__))
+
+inline void profileDump() {
+    float per_us = profileTicksPerUs();
+    Serial.println("\n[DBG]========== PROFILE (us) ==========");
+    for (int i = 0; i < profileProbeCount(); i++) {
+        const ProfileProbe &p = profileProbes()[i];
+        if (p.count == 0) continue;
+        Serial.println("[DBG]" + String(p.name) +
+                       " | n: " + String((unsigned long)p.count) +
+                       " | min: " + String(p.min / per_us, 1) +
+                       " | avg: " + String(p.total / (float)p.count / per_us, 1) +
+                       " | p99: " + String(profilePercentile(p, 99) / per_us, 1) +
+                       " | max: " + String(p.max / per_us, 1));
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
+
+inline void profileReset() {
+    for (int i = 0; i < profileProbeCount(); i++) {
+        const char *name = profileProbes()[i].name;
+        profileProbes()[i] = {};
+        profileProbes()[i].name = name;
+        profileProbes()[i].min = UINT32_MAX;
+    }
+}
+
+#else
+
+#define PROFILE_SCOPE(name) do {} while (0)
+
+inline void profileDump() { Serial.println("[DBG]Profiling not compiled in, build with -DPROFILING"); }
+inline void profileReset() {}
+
+#endif
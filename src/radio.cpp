@@ -1,12 +1,59 @@
 #include "radio.h"
+#include "profiler.h"
+#include "loopMonitor.h"
+#include "heapGuard.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Preferences.h>
+#endif
 
 #define MAX_HOP 10
 
 // ================== LOG HELPERS ==================
-#define INFO(x)  Serial.println(String("\033[32m[INFO]\033[0m ") + x)
-#define WARN(x)  Serial.println(String("\033[33m[WARN]\033[0m ") + x)
-#define ERR(x)   Serial.println(String("\033[31m[ERR]\033[0m ")  + x)
-#define DBG(x)   Serial.println(String("\033[36m[DBG]\033[0m ")  + x)
+#define INFO(x)  do { PROFILE_SCOPE("log"); Serial.println(String("\033[32m[INFO]\033[0m ") + x); } while (0)
+#define WARN(x)  do { PROFILE_SCOPE("log"); Serial.println(String("\033[33m[WARN]\033[0m ") + x); } while (0)
+#define ERR(x)   do { PROFILE_SCOPE("log"); Serial.println(String("\033[31m[ERR]\033[0m ")  + x); } while (0)
+#define DBG(x)   do { PROFILE_SCOPE("log"); Serial.println(String("\033[36m[DBG]\033[0m ")  + x); } while (0)
+
+// Local millis() at the DIO0 interrupt, not at the moment we got to the packet.
+static unsigned long rxLocalTime(const ParsedPacket &pkt) {
+    return millis() - (micros() - pkt.rx_micros) / 1000;
+}
+
+static bool isRoutedChannel(const String &channel) {
+    return channel == "DATA" || channel == "FRAG" || channel == "FSTAT" || channel == "BULK" ||
+           channel == "BACK" || channel == "TRACE" || channel == "TRACR";
+}
+
+// Mesh control frames set is_channel too; everything else that does is a
+// channel message.
+static bool isChannelMessage(const ParsedPacket &pkt) {
+    return pkt.is_channel && pkt.channel_name != "RREQ" && pkt.channel_name != "RREP" &&
+           pkt.channel_name != "RERR" && pkt.channel_name != "HELLO" && pkt.channel_name != "ACK" &&
+           pkt.channel_name != "TREE";
+}
+
+// Field index of a ||-separated body, or "" if it has fewer fields.
+static String bodyField(const String &body, int index) {
+    int start = 0;
+    for (int i = 0; i < index; i++) {
+        start = body.indexOf("||", start);
+        if (start == -1) return "";
+        start += 2;
+    }
+    int end = body.indexOf("||", start);
+    return body.substring(start, end == -1 ? body.length() : end);
+}
+
+// The neighbor a frame is addressed to, or "" when every neighbor should
+// hear it.
+static String unicastPeer(const ParsedPacket &pkt) {
+    if (pkt.channel_name == "ACK" || (pkt.channel_name == "RERR" && !pkt.is_channel)) return pkt.channel_id;
+    if (pkt.channel_name == "RREP") return bodyField(pkt.message, 4);
+    if (!isRoutedChannel(pkt.channel_name)) return "";
+    String next_hop = bodyField(pkt.message, 1);
+    return next_hop == BROADCAST_ADDRESS ? "" : next_hop;
+}
 
 // ================== CONSTRUCTOR ==================
 LoRaNode::LoRaNode(String nodeAddress, int spreadingFactor,
@@ -14,7 +61,9 @@ LoRaNode::LoRaNode(String nodeAddress, int spreadingFactor,
                    int rst, int dio0)
     : address(nodeAddress), sf(spreadingFactor), messageInterval(0), sendCounter(0),
       pin_sck(sck), pin_miso(miso), pin_mosi(mosi),
-      pin_ss(ss), pin_rst(rst), pin_dio0(dio0) {}
+      pin_ss(ss), pin_rst(rst), pin_dio0(dio0),
+      router(ROUTING_DEFAULT == ROUTING_FLOOD ? (RoutingEngine *)&flood :
+             ROUTING_DEFAULT == ROUTING_COLLECT ? (RoutingEngine *)&collect : &aodv) {}
 
 // ================== INITIALIZATION ==================
 bool LoRaNode::begin(long frequency) {
@@ -27,250 +76,3143 @@ bool LoRaNode::begin(long frequency) {
     }
 
     LoRa.setSpreadingFactor(sf);
+    LoRa.setTxPower(TX_POWER_MAX);
+    txPower = TX_POWER_MAX;
+    baseFrequency = frequency;
+    setChannels(channelCount);
+    syncRoot = address;
+
+    // Sized once so copying a frame into received_packet never reallocates.
+    received_packet.timestamp_hex.reserve(FRAME_FIELD_LEN);
+    received_packet.channel_name.reserve(FRAME_FIELD_LEN);
+    received_packet.channel_id.reserve(FRAME_FIELD_LEN);
+    received_packet.sender.reserve(FRAME_FIELD_LEN);
+    received_packet.message_id.reserve(FRAME_FIELD_LEN);
+    received_packet.message.reserve(MAX_FRAME_LENGTH);
     INFO("LoRa initialized successfully at " + String(frequency / 1E6) + " MHz");
     return true;
 }
 
 void LoRaNode::setMessageInterval(unsigned long ms) {
     messageInterval = ms;
+    traffic.next_time = millis();
 }
 
 // ================== SEND MESSAGE ==================
+// The timestamp field is the origin's stamp followed by ".<our mesh clock at
+// TX start>" when the two differ, so forwarded frames keep their origin time.
 void LoRaNode::sendMessage(const ParsedPacket &pkt) {
+    PROFILE_SCOPE("tx.send");
     sendCounter++;
 
-    String packet =
-        pkt.timestamp_hex + "||" +
-        pkt.channel_name  + "||" +
-        pkt.channel_id    + "||" +
-        pkt.sender        + "||" +
-        pkt.message_id    + "||" +
-        String(pkt.length) + "||" +
-        String(pkt.is_channel ? 1 : 0) + "||" +
-        pkt.message;
-
-    LoRa.beginPacket();
-    LoRa.print(packet);
-    LoRa.endPacket();
-
-    DBG("[TX] " + packet);
+    char stamp[12];
+    char length[12];
+    snprintf(stamp, sizeof(stamp), "%lx", meshTime());
+    snprintf(length, sizeof(length), "%d", pkt.length);
+    bool hopStamp = pkt.timestamp_hex.length() > 0 && strcasecmp(pkt.timestamp_hex.c_str(), stamp) != 0;
+
+    const char *parts[] = {
+        hopStamp ? pkt.timestamp_hex.c_str() : "", hopStamp ? "." : "", stamp, "||",
+        pkt.channel_name.c_str(), "||", pkt.channel_id.c_str(), "||",
+        pkt.sender.c_str(), "||", pkt.message_id.c_str(), "||",
+        length, "||", pkt.is_channel ? "1" : "0", "||",
+    };
+    size_t total = pkt.message.length();
+    for (const char *part : parts) total += strlen(part);
+    if (total + secureOverhead() > MAX_FRAME_LENGTH) {
+        ERR("Frame of " + String(total + secureOverhead()) + " bytes exceeds " +
+            String(MAX_FRAME_LENGTH) + ", not sent");
+        return;
+    }
+
+    unsigned long wait = 0;
+    int channel = txChannel(pkt, airtimeMs(total + secureOverhead()), wait);
+    if (channel < 0) {
+        deferFrame(pkt, wait, airtimeMs(total + secureOverhead()));
+        return;
+    }
+
+    Frame *frame = frames.acquire();
+    if (!frame) {
+        ERR("No free frame buffer, " + pkt.channel_name + " not sent");
+        return;
+    }
+    // A secured frame's header goes in front of the text; leave room for it.
+    frame->start = isSecured() ? secureOverhead() - CRYPTO_TAG_LEN : 0;
+    frame->len = frame->start;
+    for (const char *part : parts) {
+        size_t len = strlen(part);
+        memcpy(frame->data + frame->len, part, len);
+        frame->len += len;
+    }
+    memcpy(frame->data + frame->len, pkt.message.c_str(), pkt.message.length());
+    frame->len += pkt.message.length();
+    frame->data[frame->len] = '\0';
+
+    unsigned long txMicros = micros();
+    const char *text = frame->data + frame->start;
+    if (captureTx) {
+        captureFrame((const uint8_t *)text, frame->len - frame->start,
+                     CAPTURE_FLAG_TX | (isSecured() ? CAPTURE_FLAG_SECURED : 0), 0, 0, 0, txMicros);
+    }
+    DBG(String("[TX] ") + text);
+    if (isSecured()) sealFrame(*frame);
+
+    int power = txPowerFor(unicastPeer(pkt));
+    if (power != txPower) {
+        LoRa.setTxPower(power);
+        txPower = power;
+    }
+    if (power < TX_POWER_MAX) {
+        stats.reduced_power_tx++;
+        stats.tx_power_saved_db += TX_POWER_MAX - power;
+    }
+
+    tuneRadio(channel);
+    if (channel > 0) stats.data_channel_tx++;
+
+    {
+        LOOP_SECTION("tx.endPacket");
+        HEAP_FREE_SCOPE();
+        PROFILE_SCOPE("tx.radio");  // FIFO fill plus the blocking wait for TX done
+        LoRa.beginPacket();
+        LoRa.write((const uint8_t *)frame->data, frame->len);
+        LoRa.endPacket();
+    }
+    tuneRadio(listenChannel());
+    lastTxTime = millis();
+    lastTxDue = lastTxTime;
+    lastTxLength = frame->len;
+    stats.tx_frames++;
+    stats.tx_airtime_ms += airtimeMs(frame->len);
+
+    frames.release(frame);
     LoRa.receive();
 }
 
 // ================== RECEIVE MESSAGE ==================
-void LoRaNode::processReceived(int packetSize) {
+// irqMicros is the DIO0 timestamp taken in the receive ISR; callers that poll
+// instead of using the interrupt can leave it 0.
+void LoRaNode::processReceived(int packetSize, unsigned long irqMicros) {
+    PROFILE_SCOPE("rx.process");
     if (packetSize <= 0) return;
+    if (irqMicros == 0) irqMicros = micros();
 
-    String raw;
-    while (LoRa.available()) raw += (char)LoRa.read();
+    Frame *frame = frames.acquire();
+    if (!frame) {
+        while (LoRa.available()) LoRa.read();
+        WARN("No free frame buffer, RX frame dropped");
+        return;
+    }
+
+    // Read the packet registers before the FIFO: once it is drained nothing
+    // stops the next frame from overwriting them.
+    frame->rssi = LoRa.packetRssi();
+    frame->snr = LoRa.packetSnr();
+    frame->freq_error = LoRa.packetFrequencyError();
+    frame->rx_micros = irqMicros;
+    {
+        PROFILE_SCOPE("rx.spi_drain");
+        HEAP_FREE_SCOPE();
+        while (LoRa.available() && frame->len < MAX_FRAME_LENGTH) frame->data[frame->len++] = LoRa.read();
+        frame->data[frame->len] = '\0';
+    }
+    lastRxLength = packetSize;
+
+    uint8_t captureFlags = 0;
+    if (isSecured() && frame->len > 0) {
+        if (!openFrame(*frame)) {
+            if (captureRx) {
+                captureFrame((const uint8_t *)frame->data, frame->len, CAPTURE_FLAG_SECURED | CAPTURE_FLAG_AUTH_ERR,
+                             frame->rssi, frame->snr, frame->freq_error, irqMicros);
+            }
+            frames.release(frame);
+            return;
+        }
+        captureFlags = CAPTURE_FLAG_SECURED;
+    }
+    if (captureRx) {
+        captureFrame((const uint8_t *)frame->data + frame->start, frame->len - frame->start, captureFlags,
+                     frame->rssi, frame->snr, frame->freq_error, irqMicros);
+    }
 
-    if (raw.isEmpty()) {
+    if (frame->len == 0) {
         WARN("Empty LoRa payload received.");
+        frames.release(frame);
         return;
     }
 
-    DBG("RAW RX: " + raw);
-    parseRawPacket(raw, received_packet);
+    DBG(String("RAW RX: ") + (frame->data + frame->start));
+    FrameHeader hdr;
+    received_packet.valid = parseFrameHeader(*frame, hdr);
+    if (!received_packet.valid) {
+        frames.release(frame);
+        return;
+    }
+    received_packet.timestamp_hex = hdr.timestamp;
+    received_packet.tx_time = hdr.tx_time;
+    received_packet.channel_name = hdr.channel;
+    received_packet.channel_id = hdr.channel_id;
+    received_packet.sender = hdr.sender;
+    received_packet.message_id = hdr.message_id;
+    received_packet.length = hdr.length;
+    received_packet.is_channel = hdr.is_channel;
+    // A routed frame's body stays in the frame; the engine copies it out
+    // only when it is delivered.
+    received_packet.message = isRoutedChannel(received_packet.channel_name) ? "" : hdr.payload;
+    received_packet.rssi = frame->rssi;
+    received_packet.snr = frame->snr;
+    received_packet.freq_error = frame->freq_error;
+    received_packet.spreading_factor = sf;
+    received_packet.rx_micros = frame->rx_micros;
+    received_packet.hop_latency_ms = -1;
+    received_packet.latency_ms = -1;
+
+    if (received_packet.sender == address) {
+        received_packet.message = hdr.payload;  // our own frame echoed back, passed through as is
+        frames.release(frame);
+        return;
+    }
+    dispatchReceived(hdr);
+    frames.release(frame);
+
+    if (received_packet.valid && received_packet.channel_name == "DATA" &&
+        received_packet.message.startsWith("GEN|")) {
+        observeTraffic(received_packet);
+    }
+}
+
+// Runs while the RX frame is still owned, so hdr's payload stays valid.
+void LoRaNode::dispatchReceived(const FrameHeader &hdr) {
+    updateNeighbor(received_packet);
 
-    if (!received_packet.valid) return;
-    if (received_packet.sender == address) return;
+    if (isTimeSynced() && neighbor_table[received_packet.sender].time_root == syncRoot) {
+        unsigned long rx_time = meshTime(rxLocalTime(received_packet));
+        unsigned long origin_time = strtoul(received_packet.timestamp_hex.c_str(), nullptr, 16);
+        received_packet.hop_latency_ms = (long)(rx_time - received_packet.tx_time);
+        received_packet.latency_ms = (long)(rx_time - origin_time);
+    }
 
-    if (received_packet.channel_name == "RREQ" || received_packet.channel_name == "RREP") {
-        receiveAODV(received_packet);
+    if (received_packet.channel_name == "ACK") {
+        handleAck(received_packet);
+    } else if (received_packet.channel_name == "HELLO") {
+        handleHello(received_packet);
+    } else if (isChannelMessage(received_packet)) {
+        flood.receive(received_packet, hdr);
+    } else {
+        router->receive(received_packet, hdr);
     }
 }
 
 // ================== PARSER ==================
-void LoRaNode::parseRawPacket(String raw, ParsedPacket &pkt) {
-    pkt.valid = false;
-    raw.trim();
-    if (raw.length() == 0) return;
-
-    String parts[8];
-    int lastIndex = 0;
-    int partIndex = 0;
-
-    for (; partIndex < 7; ++partIndex) {
-        int sepIndex = raw.indexOf("||", lastIndex);
-        if (sepIndex == -1) return;
-        parts[partIndex] = raw.substring(lastIndex, sepIndex);
-        parts[partIndex].trim();
-        lastIndex = sepIndex + 2;
-    }
-    parts[7] = raw.substring(lastIndex);
-    parts[7].trim();
-
-    pkt.timestamp_hex = parts[0];
-    pkt.channel_name  = parts[1];
-    pkt.channel_id    = parts[2];
-    pkt.sender        = parts[3];
-    pkt.message_id    = parts[4];
-    pkt.length        = parts[5].toInt();
-    pkt.is_channel    = (parts[6].toInt() == 1);
-    pkt.message       = parts[7];
-    pkt.valid         = true;
+// Header fields are trimmed and must fit FRAME_FIELD_LEN; the message is kept
+// byte-exact so payloads and fragments that end in whitespace survive.
+static bool copyField(char *dst, const char *begin, const char *end) {
+    while (begin < end && isspace((unsigned char)*begin)) begin++;
+    while (end > begin && isspace((unsigned char)end[-1])) end--;
+    if (end - begin >= FRAME_FIELD_LEN) return false;
+    memcpy(dst, begin, end - begin);
+    dst[end - begin] = '\0';
+    return true;
 }
 
-// ================== AODV FUNCTIONS ==================
-void LoRaNode::sendDataAODV(const String &dest, const String &message) {
-    if (routing_table.count(dest) && routing_table[dest].valid) {
-        INFO("Found route to " + dest + " via " + routing_table[dest].next_hop);
-        ParsedPacket pkt;
-        pkt.sender = getAddress();
-        pkt.message_id = String(millis());
-        pkt.timestamp_hex = String(millis(), HEX);
-        pkt.channel_name = "DATA";
-        pkt.channel_id = dest;
-        pkt.length = message.length();
-        pkt.is_channel = false;
-        pkt.message = message;
-        sendMessage(pkt);
+// Splits a routed body origin||next_hop||flag||body in place; false for
+// unrouted text.
+static bool parseRouted(FrameHeader &hdr) {
+    char flag[FRAME_FIELD_LEN];
+    char *fields[3] = {hdr.origin, hdr.next_hop, flag};
+
+    const char *pos = hdr.payload;
+    for (int i = 0; i < 3; i++) {
+        const char *sep = strstr(pos, "||");
+        if (!sep || !copyField(fields[i], pos, sep)) return false;
+        pos = sep + 2;
+    }
+    hdr.flag = atoi(flag);
+    hdr.body = pos;
+    hdr.body_len = hdr.payload + hdr.payload_len - pos;
+    return true;
+}
+
+bool parseFrameHeader(const Frame &frame, FrameHeader &hdr) {
+    PROFILE_SCOPE("rx.parse");
+    HEAP_FREE_SCOPE();
+    char stamp[FRAME_FIELD_LEN], length[FRAME_FIELD_LEN], is_channel[FRAME_FIELD_LEN];
+    char *fields[7] = {stamp, hdr.channel, hdr.channel_id, hdr.sender, hdr.message_id, length, is_channel};
+
+    const char *pos = frame.data + frame.start;
+    for (int i = 0; i < 7; i++) {
+        const char *sep = strstr(pos, "||");
+        if (!sep || !copyField(fields[i], pos, sep)) return false;
+        pos = sep + 2;
+    }
+    hdr.payload = pos;
+    hdr.payload_len = frame.data + frame.len - pos;
+    hdr.routed = parseRouted(hdr);
+
+    char *dot = strchr(stamp, '.');
+    hdr.tx_time = strtoul(dot ? dot + 1 : stamp, nullptr, 16);  // origin stamp if no hop stamp
+    if (dot) *dot = '\0';
+    strcpy(hdr.timestamp, stamp);
+    hdr.length = atoi(length);
+    hdr.is_channel = atoi(is_channel) == 1;
+    return true;
+}
+
+// Streams straight to out, so long reassembled messages need no buffer.
+size_t printPacket(Print &out, const ParsedPacket &pkt) {
+    size_t n = 0;
+    n += out.print(pkt.timestamp_hex);
+    n += out.print("||");
+    n += out.print(pkt.channel_name);
+    n += out.print("||");
+    n += out.print(pkt.channel_id);
+    n += out.print("||");
+    n += out.print(pkt.sender);
+    n += out.print("||");
+    n += out.print(pkt.message_id);
+    n += out.print("||");
+    n += out.print(pkt.length);
+    n += out.print(pkt.is_channel ? "||1||" : "||0||");
+    n += out.print(pkt.message);
+    n += out.print("||");
+    n += out.print((int)pkt.spreading_factor);
+    n += out.print("||");
+    n += out.print(pkt.rssi);
+    n += out.print("||");
+    n += out.print(pkt.snr, 2);
+    n += out.print("||");
+    n += out.print(pkt.freq_error);
+    n += out.print("||");
+    n += out.print(pkt.rx_micros);
+    n += out.print("||");
+    n += out.print(pkt.hop_latency_ms);
+    n += out.print("||");
+    n += out.print(pkt.latency_ms);
+    return n;
+}
+
+// ================== FRAME BUFFERS ==================
+FramePool::FramePool() : free_count(FRAME_POOL_SIZE) {
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) free_list[i] = &frames[i];
+}
+
+Frame *FramePool::acquire() {
+    if (free_count == 0) {
+        exhausted_count++;
+        return nullptr;
+    }
+    Frame *frame = free_list[--free_count];
+    frame->len = 0;
+    frame->start = 0;
+    frame->data[0] = '\0';
+    high_water = max(high_water, inUse());
+    return frame;
+}
+
+void FramePool::release(Frame *frame) {
+    if (frame) free_list[free_count++] = frame;
+}
+
+// ================== ROUTING ENGINES ==================
+bool LoRaNode::sendData(const String &dest, const String &message) {
+    if ((int)message.length() > maxPayload()) return sendFragmented(dest, message);
+    return sendRouted(dest, "DATA", message);
+}
+
+bool LoRaNode::sendRouted(const String &dest, const String &channel, const String &message, bool ack) {
+    return router->send(dest, channel, message, ack);
+}
+
+bool LoRaNode::setRouting(uint8_t mode) {
+    RoutingEngine *next = mode == ROUTING_AODV ? (RoutingEngine *)&aodv
+                        : mode == ROUTING_FLOOD ? (RoutingEngine *)&flood
+                        : mode == ROUTING_COLLECT ? (RoutingEngine *)&collect : nullptr;
+    if (!next) return false;
+    if (next != router) router->reset();
+    router = next;
+    INFO(String("Routing engine: ") + router->name());
+    return true;
+}
+
+// Channel messages flood under either engine.
+void LoRaNode::serviceRouting() {
+    router->service();
+    if (router != &flood) flood.service();
+}
+
+bool AodvRouting::send(const String &dest, const String &channel, const String &message, bool ack) {
+    return node.sendRoutedAODV(dest, channel, message, ack);
+}
+
+bool AodvRouting::receive(ParsedPacket &pkt, const FrameHeader &hdr) {
+    if (pkt.channel_name == "RREQ" || pkt.channel_name == "RREP") {
+        node.receiveAODV(pkt);
+    } else if (pkt.channel_name == "RERR") {
+        node.handleRERR(pkt);
+    } else if (isRoutedChannel(pkt.channel_name)) {
+        node.handleData(pkt, hdr);
     } else {
-        WARN("No route to " + dest + ", sending RREQ...");
-        sendRREQ(dest);
+        return false;
     }
+    return true;
 }
 
-// ================== SEND RREQ ==================
-void LoRaNode::sendRREQ(const String &dest) {
-    broadcastCounter++;
-    RREQPacket rreq{getAddress(), dest, millis(), 0, broadcastCounter, 0, MAX_HOP};
+void AodvRouting::refresh() { node.refreshAODVTable(); }
 
-    INFO("Sending RREQ to " + dest);
-    DBG("  src_seq=" + String(rreq.source_seq) +
-        " dest_seq=" + String(rreq.dest_seq) +
-        " bcast_id=" + String(rreq.broadcast_id));
+void AodvRouting::linkBroken(const String &neighbor) { node.handleLinkBreak(neighbor); }
+
+String AodvRouting::nextHop(const String &dest) {
+    auto it = node.routing_table.find(dest);
+    if (it == node.routing_table.end() || !it->second.valid) return "";
+    return node.selectNextHop(it->second);
+}
+
+bool AodvRouting::canReach(const String &dest) {
+    auto it = node.routing_table.find(dest);
+    return it != node.routing_table.end() && it->second.valid;
+}
+
+void AodvRouting::discover(const String &dest) { node.sendRREQ(dest); }
+
+void AodvRouting::printTable() { node.printAODVTable(); }
+
+bool FloodRouting::send(const String &dest, const String &channel, const String &message, bool) {
+    node.lastDataId = max(millis(), node.lastDataId + 1);
 
     ParsedPacket pkt;
-    pkt.sender = getAddress();
-    pkt.channel_name = "RREQ";
+    pkt.sender = node.address;
+    pkt.message_id = String(node.lastDataId);
+    pkt.timestamp_hex = String(node.meshTime(), HEX);
+    pkt.channel_name = channel;
     pkt.channel_id = dest;
-    pkt.message = String(rreq.source_seq) + "||" + String(rreq.dest_seq) + "||" +
-                  String(rreq.broadcast_id) + "||" + String(rreq.hop_count) + "||" + String(rreq.ttl);
+    pkt.length = message.length();
+    pkt.is_channel = false;
+    pkt.valid = true;
+    pkt.message = node.address + "||" + BROADCAST_ADDRESS + "||" + String(FLOOD_HOP_LIMIT) + "||" + message;
+    seenBefore(node.address + ":" + pkt.message_id);
+    node.sendMessage(pkt);
+    return true;
+}
+
+// The host's sender field is kept as the origin; the frame itself goes out
+// from us so neighbors learn the right link.
+bool FloodRouting::broadcast(ParsedPacket pkt) {
+    String origin = pkt.sender.length() ? pkt.sender : node.address;
+    if (pkt.message_id.length() == 0) {
+        node.lastDataId = max(millis(), node.lastDataId + 1);
+        pkt.message_id = String(node.lastDataId);
+    }
+    if (pkt.timestamp_hex.length() == 0) pkt.timestamp_hex = String(node.meshTime(), HEX);
+    if (pkt.channel_id.length() == 0) pkt.channel_id = BROADCAST_ADDRESS;
     pkt.length = pkt.message.length();
     pkt.is_channel = true;
-    pkt.timestamp_hex = String(millis(), HEX);
-    pkt.message_id = String(millis());
-    sendMessage(pkt);
-    printRoutingTable();
+    pkt.valid = true;
+    pkt.sender = node.address;
+    pkt.message = origin + "||" + BROADCAST_ADDRESS + "||" + String(FLOOD_HOP_LIMIT) + "||" + pkt.message;
+    seenBefore(origin + ":" + pkt.message_id);
+    node.sendMessage(pkt);
+    return true;
 }
 
-// ================== RECEIVE AODV ==================
-void LoRaNode::receiveAODV(const ParsedPacket &pkt) {
-    if (pkt.channel_name == "RREQ") {
-        unsigned long src_seq, dst_seq;
-        int bcast_id, hop, ttl;
-        sscanf(pkt.message.c_str(), "%lu||%lu||%d||%d||%d", &src_seq, &dst_seq, &bcast_id, &hop, &ttl);
-        RREQPacket rreq{pkt.sender, pkt.channel_id, src_seq, dst_seq, bcast_id, hop, ttl};
-        handleRREQ(rreq);
-    } else if (pkt.channel_name == "RREP") {
-    unsigned long dest_seq;
-    int hop;
+// Takes flooded routed frames and every channel message. A channel message
+// is delivered and relayed everywhere; a routed frame only reaches the host
+// at its destination (or everywhere for FF) and is not relayed past it.
+bool FloodRouting::receive(ParsedPacket &pkt, const FrameHeader &hdr) {
+    bool channel = pkt.is_channel;
+    if (!channel && !isRoutedChannel(pkt.channel_name)) return false;
+    // A channel message is ours if it carries the flood header, whatever its
+    // channel id; a routed frame also needs a destination.
+    if (!hdr.routed || (channel ? strcmp(hdr.next_hop, BROADCAST_ADDRESS) != 0 : pkt.channel_id.length() == 0)) {
+        pkt.message = hdr.payload;
+        return true;  // unrouted DATA or a channel message from an older node, pass through
+    }
+    pkt.valid = false;
+    String origin = hdr.origin;
+    if (strcmp(hdr.next_hop, BROADCAST_ADDRESS) != 0 || origin == node.address) return true;
+
+    // A copy relayed with no more hops left than ours comes from a node at
+    // least as far out as us; with SNR-weighted slots it usually beat us
+    // because it is farther from the last sender, so our relay adds little.
+    // Late copies from nearer the origin do not count.
+    String key = origin + ":" + pkt.message_id;
+    int hops_left = hdr.flag - 1;
+    for (auto it = relays.begin(); it != relays.end(); ++it) {
+        if (it->key != key) continue;
+        if (hops_left + 1 > it->hops_left) return true;
+        if (++it->copies_heard >= FLOOD_SUPPRESS_COPIES) {
+            DBG("Relay of " + key + " suppressed, heard from " + pkt.sender);
+            node.stats.flood_suppressed++;
+            relays.erase(it);
+        }
+        return true;
+    }
+    if (seenBefore(key)) {
+        node.stats.duplicates_dropped++;
+        return true;
+    }
+
+    if ((channel || pkt.channel_id != node.address) && hops_left > 0) {
+        if (relays.size() >= FLOOD_RELAY_QUEUE) {
+            WARN("Flood relay queue full, not relaying " + key);
+        } else {
+            FloodRelay relay;
+            relay.pkt = pkt;
+            relay.pkt.valid = true;
+            relay.pkt.sender = node.address;
+            relay.pkt.message = origin + "||" + BROADCAST_ADDRESS + "||" + String(hops_left) + "||" +
+                                node.forwardedBody(pkt, hdr);
+            relay.key = key;
+            relay.due = millis() + relayDelay(pkt.snr);
+            relay.hops_left = hops_left;
+            relay.copies_heard = 0;
+            relays.push_back(relay);
+        }
+    }
 
-    sscanf(pkt.message.c_str(), "%lu||%d", &dest_seq, &hop);
-    RREPPacket rrep{pkt.channel_id, pkt.sender, dest_seq, hop};
-    handleRREP(rrep);
+    if (channel) {
+        pkt.valid = true;
+        pkt.sender = origin;
+        pkt.message = hdr.body;
+    } else if (pkt.channel_id == node.address || pkt.channel_id == BROADCAST_ADDRESS) {
+        pkt.valid = true;
+        node.deliverRouted(pkt, hdr);
     }
+    return true;
+}
 
+void FloodRouting::service() {
+    unsigned long now = millis();
+    for (size_t i = 0; i < relays.size(); ) {
+        if ((long)(now - relays[i].due) < 0) {
+            i++;
+            continue;
+        }
+        FloodRelay relay = relays[i];
+        relays.erase(relays.begin() + i);
+        node.stats.flood_relayed++;
+        node.sendMessage(relay.pkt);
+    }
 }
 
-// ================== HANDLE RREQ ==================
-void LoRaNode::handleRREQ(const RREQPacket &rreq) {
-    String key = rreq.source + "_" + String(rreq.broadcast_id);
-    if (seen_broadcasts[key] >= rreq.broadcast_id) {
-        DBG("Duplicate RREQ ignored from " + rreq.source);
-        return;
+bool FloodRouting::seenBefore(const String &key) {
+    if (std::find(seen.begin(), seen.end(), key) != seen.end()) return true;
+    if (seen.size() < FLOOD_SEEN_CACHE) {
+        seen.push_back(key);
+    } else {
+        seen[seenIndex] = key;
+        seenIndex = (seenIndex + 1) % FLOOD_SEEN_CACHE;
     }
-    seen_broadcasts[key] = rreq.broadcast_id;
+    return false;
+}
+
+// Slot grows linearly with SNR across the window, plus up to one airtime of
+// jitter so receivers at similar range do not collide.
+unsigned long FloodRouting::relayDelay(float snr) const {
+    unsigned long slot = node.airtimeMs(node.lastRxLength);
+    float weight = constrain((snr - FLOOD_SNR_MIN) / (FLOOD_SNR_MAX - FLOOD_SNR_MIN), 0.0f, 1.0f);
+    return FLOOD_RELAY_GUARD + (unsigned long)(weight * (FLOOD_RELAY_SLOTS - 1) * slot) + random(0, slot + 1);
+}
 
-    INFO("Handling RREQ from " + rreq.source + " to " + rreq.destination);
-    if (!routing_table.count(rreq.source) || !routing_table[rreq.source].valid) {
-        routing_table[rreq.source] = {rreq.source, rreq.source, rreq.hop_count + 1, rreq.source_seq, true, millis() + 60000};
+void FloodRouting::printTable() {
+    LOOP_SECTION("print");
+    Serial.println("\n[DBG]========== FLOOD RELAYS (" + node.address + ") ==========");
+    unsigned long now = millis();
+    for (auto &relay : relays) {
+        Serial.println("[DBG]Frame: " + relay.key +
+                       " | " + relay.pkt.channel_name + " -> " + relay.pkt.channel_id +
+                       " | Due in: " + String((long)(relay.due - now)) + " ms" +
+                       " | Copies heard: " + String(relay.copies_heard));
     }
+    Serial.println("[DBG]Relayed: " + String(node.stats.flood_relayed) +
+                   " | Suppressed: " + String(node.stats.flood_suppressed));
+    Serial.println("[DBG]=====================================================\n");
+}
 
-    if (getAddress() == rreq.destination) {
-        INFO("Destination reached (" + address + "), sending RREP");
-        sendRREP(rreq.source, rreq.source, 0, rreq.dest_seq);
+// ------------------ Collection tree ------------------
+void CollectionRouting::setSink(bool enable) {
+    sinkNode = enable;
+    sink = enable ? node.address : "";
+    parent = "";
+    parentCount = 0;
+    advertised = enable ? 0 : COLLECT_NO_ROUTE;
+    trickleInterval = 0;
+    INFO("Collection sink " + String(enable ? "enabled" : "disabled"));
+}
+
+int CollectionRouting::pathCost(const TreeCandidate &candidate) {
+    return min(candidate.cost + node.linkMetric(candidate.address), (int)COLLECT_NO_ROUTE);
+}
+
+int CollectionRouting::cost() {
+    if (sinkNode) return 0;
+    return parent.length() ? pathCost(parents[0]) : COLLECT_NO_ROUTE;
+}
+
+// Only the current parent and candidates advertising less than we last
+// advertised are feasible, so a node never switches to one of its own
+// descendants. A backup replaces the parent only when it is
+// COLLECT_SWITCH_GAIN cheaper.
+void CollectionRouting::selectParent() {
+    String old = parent;
+    int old_cost = cost();
+    auto feasible = [&](const TreeCandidate &c) {
+        return c.address == old || c.cost < advertised || advertised == COLLECT_NO_ROUTE;
+    };
+    std::sort(parents, parents + parentCount, [&](const TreeCandidate &a, const TreeCandidate &b) {
+        if (feasible(a) != feasible(b)) return feasible(a);
+        return pathCost(a) < pathCost(b);
+    });
+    for (int i = 1; i < parentCount && old.length(); i++) {
+        if (parents[i].address == old && feasible(parents[i]) &&
+            pathCost(parents[i]) < pathCost(parents[0]) + COLLECT_SWITCH_GAIN) {
+            std::swap(parents[0], parents[i]);
+        }
+    }
+    parent = parentCount && feasible(parents[0]) && pathCost(parents[0]) < COLLECT_NO_ROUTE ? parents[0].address : "";
+
+    if (parent != old) {
+        node.stats.parent_changes++;
+        INFO("Collection parent " + (old.length() ? old : String("-")) + " -> " +
+             (parent.length() ? parent : String("-")) + " (ETX " + String(cost() / (float)METRIC_SCALE) + ")");
+        resetTrickle();
+    } else if (abs(cost() - old_cost) >= COLLECT_SWITCH_GAIN) {
+        resetTrickle();
+    }
+}
+
+void CollectionRouting::dropCandidate(const String &neighbor) {
+    for (int i = 0; i < parentCount; i++) {
+        if (parents[i].address != neighbor) continue;
+        parents[i] = parents[--parentCount];
+        selectParent();
         return;
     }
+}
 
-    if (rreq.ttl <= 0) return;
+void CollectionRouting::handleBeacon(const ParsedPacket &pkt) {
+    char sink_buf[16];
+    int adv, pull;
+    if (sscanf(pkt.message.c_str(), "%15[^|]||%d||%d", sink_buf, &adv, &pull) != 3) {
+        WARN("Malformed TREE beacon from " + pkt.sender);
+        return;
+    }
+    if (pull) resetTrickle();
+    if (sinkNode || strcmp(sink_buf, "-") == 0) return;
+    if (sink.length() == 0) sink = sink_buf;
+    if (sink != sink_buf) return;
 
-    RREQPacket newRREQ = rreq;
-    newRREQ.hop_count++;
-    newRREQ.ttl--;
+    if (adv >= COLLECT_NO_ROUTE) {
+        dropCandidate(pkt.sender);
+        return;
+    }
+    TreeCandidate candidate{pkt.sender, adv};
+    for (int i = 0; i < parentCount; i++) {
+        if (parents[i].address == pkt.sender) {
+            parents[i].cost = adv;
+            selectParent();
+            return;
+        }
+    }
+    if (parentCount < COLLECT_PARENTS) {
+        parents[parentCount++] = candidate;
+    } else if (pathCost(candidate) < pathCost(parents[COLLECT_PARENTS - 1]) &&
+               parents[COLLECT_PARENTS - 1].address != parent) {
+        parents[COLLECT_PARENTS - 1] = candidate;
+    } else {
+        return;
+    }
+    selectParent();
+}
 
+void CollectionRouting::sendBeacon() {
+    advertised = cost();
+    bool pull = !sinkNode && parent.length() == 0;
     ParsedPacket pkt;
-    pkt.sender = getAddress();
-    pkt.channel_name = "RREQ";
-    pkt.channel_id = rreq.destination;
-    pkt.message = String(newRREQ.source_seq) + "||" + String(newRREQ.dest_seq) + "||" +
-                  String(newRREQ.broadcast_id) + "||" + String(newRREQ.hop_count) + "||" + String(newRREQ.ttl);
+    pkt.sender = node.address;
+    pkt.channel_name = "TREE";
+    pkt.channel_id = BROADCAST_ADDRESS;
+    pkt.message = (sink.length() ? sink : String("-")) + "||" + String(advertised) + "||" + String(pull ? 1 : 0);
     pkt.length = pkt.message.length();
     pkt.is_channel = true;
-    pkt.timestamp_hex = String(millis(), HEX);
+    pkt.timestamp_hex = String(node.meshTime(), HEX);
     pkt.message_id = String(millis());
+    node.stats.tree_beacons++;
+    node.sendMessage(pkt);
+}
 
-    delay(random(10, 50));
-    sendMessage(pkt);
-    printRoutingTable();
+// Trickle: one beacon at a random point in the second half of every
+// interval; a reset while already at Imin changes nothing.
+void CollectionRouting::resetTrickle() {
+    if (trickleInterval == COLLECT_BEACON_MIN) return;
+    trickleInterval = COLLECT_BEACON_MIN;
+    startTrickleInterval();
 }
 
-// ================== HANDLE RREP ==================
-void LoRaNode::handleRREP(const RREPPacket &rrep) {
-    INFO("Received RREP from " + rrep.source + " for " + rrep.destination);
-    routing_table[rrep.destination] = {rrep.destination, rrep.source, rrep.hop_count,
-                                       rrep.dest_seq, true, millis() + 60000};
-    printRoutingTable();
+void CollectionRouting::startTrickleInterval() {
+    trickleStart = millis();
+    trickleFire = trickleStart + trickleInterval / 2 + random(0, trickleInterval / 2);
+    trickleFired = false;
 }
 
-// ================== SEND RREP ==================
-void LoRaNode::sendRREP(const String &dest, const String &next_hop, int hop_count, int dest_seq) {
-    INFO("Sending RREP to " + dest);
+void CollectionRouting::service() {
+    if (trickleInterval == 0) resetTrickle();
+    unsigned long now = millis();
+    if (!trickleFired && (long)(now - trickleFire) >= 0) {
+        trickleFired = true;
+        sendBeacon();
+    }
+    if (now - trickleStart >= trickleInterval) {
+        trickleInterval = min(trickleInterval * 2, (unsigned long)COLLECT_BEACON_MAX);
+        startTrickleInterval();
+    }
+}
+
+void CollectionRouting::refresh() { node.refreshAODVTable(); }
+
+void CollectionRouting::linkBroken(const String &neighbor) {
+    dropCandidate(neighbor);
+    node.handleLinkBreak(neighbor);
+}
+
+String CollectionRouting::nextHop(const String &dest) {
+    if (sink.length() && dest == sink) return parent;
+    return node.aodv.nextHop(dest);
+}
+
+// Same split as send(): the sink is reachable through any parent, and a
+// missing one is looked for by speeding up beacons rather than with an RREQ.
+bool CollectionRouting::canReach(const String &dest) {
+    if (sink.length() == 0 || dest != sink || sinkNode) return node.aodv.canReach(dest);
+    return parent.length() > 0;
+}
+
+void CollectionRouting::discover(const String &dest) {
+    if (sink.length() == 0 || dest != sink || sinkNode) node.aodv.discover(dest);
+    else resetTrickle();
+}
+
+bool CollectionRouting::send(const String &dest, const String &channel, const String &message, bool ack) {
+    if (sink.length() == 0 || dest != sink || sinkNode) return node.sendRoutedAODV(dest, channel, message, ack);
+    if (parent.length() == 0) {
+        WARN("No parent toward sink " + sink);
+        resetTrickle();
+        return false;
+    }
+    node.lastDataId = max(millis(), node.lastDataId + 1);
+
     ParsedPacket pkt;
-    pkt.sender = getAddress();
-    pkt.channel_name = "RREP";
+    pkt.sender = node.address;
+    pkt.message_id = String(node.lastDataId);
+    pkt.timestamp_hex = String(node.meshTime(), HEX);
+    pkt.channel_name = channel;
     pkt.channel_id = dest;
-    pkt.message = String(dest_seq) + "||" + String(hop_count);
-    pkt.length = pkt.message.length();
-    pkt.is_channel = true;
-    pkt.timestamp_hex = String(millis(), HEX);
-    pkt.message_id = String(millis());
-    sendMessage(pkt);
-    printRoutingTable();
+    pkt.length = message.length();
+    pkt.is_channel = false;
+    pkt.valid = true;
+    forward(pkt, node.address, message, ack);
+    return true;
 }
 
-// ================== LINK BREAK ==================
-void LoRaNode::handleLinkBreak(const String &next_hop) {
-    for (auto &entry : routing_table) {
-        if (entry.second.next_hop == next_hop) entry.second.valid = false;
+void CollectionRouting::forward(const ParsedPacket &pkt, const String &origin, const String &payload, bool ack) {
+    if (parent.length() == 0) {
+        WARN("No parent toward sink " + sink + ", dropping " + pkt.channel_name + " from " + origin);
+        node.stats.dead_route_drops++;
+        resetTrickle();
+        return;
+    }
+    ParsedPacket fwd = pkt;
+    fwd.valid = true;
+    fwd.sender = node.address;
+    if (node.hopAcks && ack) {
+        node.queueFrame(fwd, origin, payload, parent);
+        return;
     }
+    fwd.message = origin + "||" + parent + "||0||" + payload;
+    node.sendMessage(fwd);
 }
 
-// ================== PRINT ROUTING TABLE ==================
-void LoRaNode::printRoutingTable() {
-    Serial.println("\n[DBG]========== ROUTING TABLE (" + address + ") ==========");
-    for (auto &e : routing_table) {
-        Serial.println("[DBG]Dest: " + e.second.destination +
-                       " | NextHop: " + e.second.next_hop +
-                       " | Hops: " + String(e.second.hop_count) +
-                       " | Seq: " + String(e.second.sequence_number) +
-                       " | Valid: " + String(e.second.valid ? "Yes" : "No"));
+// Frames for the sink climb the tree; everything else is AODV's. Traffic from
+// our own parent, or from a node advertising no more than we do, means the
+// gradient is inconsistent (CTP's datapath validation).
+bool CollectionRouting::receive(ParsedPacket &pkt, const FrameHeader &hdr) {
+    if (pkt.channel_name == "TREE") {
+        handleBeacon(pkt);
+        pkt.valid = false;
+        return true;
+    }
+    if (!isRoutedChannel(pkt.channel_name) || sink.length() == 0 || pkt.channel_id != sink) {
+        return node.aodv.receive(pkt, hdr);
+    }
+    if (!hdr.routed) {
+        pkt.message = hdr.payload;
+        return true;
+    }
+    String origin = hdr.origin;
+    bool ack = hdr.flag == 1;
+
+    node.confirmPending(pkt.sender, origin, pkt.message_id);
+    if (node.address != hdr.next_hop) {
+        pkt.valid = false;
+        return true;
+    }
+    if (node.isDuplicate(origin + ":" + pkt.message_id)) {
+        node.stats.duplicates_dropped++;
+        if (ack) node.sendAck(pkt.sender, origin, pkt.message_id);
+        pkt.valid = false;
+        return true;
+    }
+    if (ack) node.sendAck(pkt.sender, origin, pkt.message_id);
+    if (sinkNode) {
+        node.deliverRouted(pkt, hdr);
+        return true;
     }
-    Serial.println("[DBG]=====================================================\n");
-}
 
+    pkt.valid = false;
+    if (pkt.sender == parent) {
+        WARN("Collection loop through " + parent + ", dropping it as parent");
+        node.stats.tree_loops++;
+        dropCandidate(parent);
+    } else {
+        for (int i = 0; i < parentCount; i++) {
+            if (parents[i].address == pkt.sender && parents[i].cost <= cost()) {
+                node.stats.tree_loops++;
+                resetTrickle();
+            }
+        }
+    }
+    forward(pkt, origin, node.forwardedBody(pkt, hdr), ack);
+    return true;
+}
 
-void LoRaNode::refreshAODVTable() {
-    unsigned long currentTime = millis();
-    for (auto it = routing_table.begin(); it != routing_table.end(); ) {
-        if (it->second.expiration_time < currentTime) {
-            INFO("Route to " + it->first + " expired, removing.");
-            it = routing_table.erase(it);
-        } else {
-            ++it;
+void CollectionRouting::printTable() {
+    {
+        LOOP_SECTION("print");
+        Serial.println("\n[DBG]========== COLLECTION TREE (" + node.address + ") ==========");
+        Serial.println("[DBG]Sink: " + (sink.length() ? sink : String("-")) + (sinkNode ? " (us)" : "") +
+                       " | ETX: " + String(cost() / (float)METRIC_SCALE) +
+                       " | Beacon interval: " + String(trickleInterval) + " ms");
+        for (int i = 0; i < parentCount; i++) {
+            Serial.println("[DBG]Candidate: " + parents[i].address +
+                           " | Advertised: " + String(parents[i].cost / (float)METRIC_SCALE) +
+                           " | Via: " + String(pathCost(parents[i]) / (float)METRIC_SCALE) +
+                           " | Parent: " + String(parents[i].address == parent ? "Yes" : "No"));
         }
+        Serial.println("[DBG]=====================================================\n");
     }
+    node.printAODVTable();
+}
+
+// ================== AODV FUNCTIONS ==================
+// Sends a routed unicast frame (DATA, FRAG, FSTAT, ...) along the current route,
+// or starts discovery and returns false when there is none.
+bool LoRaNode::sendRoutedAODV(const String &dest, const String &channel, const String &message, bool ack) {
+    if (!routing_table.count(dest) || !routing_table[dest].valid) {
+        WARN("No route to " + dest + ", sending RREQ...");
+        sendRREQ(dest);
+        return false;
+    }
+
+    RouteEntry &route = routing_table[dest];
+    const String &next_hop = selectNextHop(route);
+    INFO("Found route to " + dest + " via " + next_hop);
+    route.expiration_time = millis() + ROUTE_LIFETIME;
+    route.passive = false;
+
+    // Ids must stay unique per origin for duplicate detection downstream.
+    lastDataId = max(millis(), lastDataId + 1);
+
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.message_id = String(lastDataId);
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.channel_name = channel;
+    pkt.channel_id = dest;
+    pkt.length = message.length();
+    pkt.is_channel = false;
+    pkt.valid = true;
+
+    if (hopAcks && ack) {
+        queueFrame(pkt, getAddress(), message, next_hop);
+        return true;
+    }
+    // Routed frames carry origin, next hop and an ACK-request flag ahead of
+    // the payload; the header sender is rewritten by every forwarder.
+    pkt.message = getAddress() + "||" + next_hop + "||0||" + message;
+    sendMessage(pkt);
+    return true;
+}
+
+// ================== HANDLE DATA ==================
+void LoRaNode::handleData(ParsedPacket &pkt, const FrameHeader &hdr) {
+    if (pkt.channel_id.length() == 0 || !hdr.routed) {
+        pkt.message = hdr.payload;
+        return;  // unrouted DATA, pass through
+    }
+    String origin = hdr.origin;
+    bool ack = hdr.flag == 1;
+
+    // Hearing our next hop forward a frame we sent it is as good as an ACK.
+    confirmPending(pkt.sender, origin, pkt.message_id);
+
+    // Traffic from origin coming through sender shows our route back still works.
+    auto back = routing_table.find(origin);
+    if (routeLearning && back != routing_table.end() && back->second.valid &&
+        back->second.next_hop == pkt.sender) {
+        back->second.expiration_time = millis() + ROUTE_LIFETIME;
+    }
+
+    if (address != hdr.next_hop) {
+        pkt.valid = false;  // overheard, someone else is forwarding it
+        return;
+    }
+
+    if (isDuplicate(origin + ":" + pkt.message_id)) {
+        // Our ACK or our forward went missing; confirm explicitly this time.
+        DBG("Duplicate DATA " + origin + ":" + pkt.message_id + " from " + pkt.sender);
+        stats.duplicates_dropped++;
+        if (ack) sendAck(pkt.sender, origin, pkt.message_id);
+        pkt.valid = false;
+        return;
+    }
+
+    if (pkt.channel_id == address) {
+        if (ack) sendAck(pkt.sender, origin, pkt.message_id);
+        deliverRouted(pkt, hdr);
+        return;
+    }
+
+    pkt.valid = false;
+    if (!routing_table.count(pkt.channel_id) || !routing_table[pkt.channel_id].valid) {
+        WARN("No route to " + pkt.channel_id + ", dropping DATA from " + origin);
+        stats.dead_route_drops++;
+        stats.dead_route_airtime_ms += airtimeMs(lastRxLength);
+        if (ack) sendAck(pkt.sender, origin, pkt.message_id);
+        sendRERR({pkt.channel_id}, {pkt.sender});
+        return;
+    }
+
+    RouteEntry &route = routing_table[pkt.channel_id];
+    const String &fwd_hop = selectNextHop(route);
+    route.expiration_time = millis() + ROUTE_LIFETIME;
+    route.passive = false;
+    addPrecursor(pkt.channel_id, pkt.sender);
+    addPrecursor(origin, fwd_hop);
+    DBG("Forwarding " + pkt.channel_name + " " + origin + " -> " + pkt.channel_id + " via " + fwd_hop);
+
+    String payload = forwardedBody(pkt, hdr);
+    ParsedPacket fwd = pkt;
+    fwd.valid = true;
+    fwd.sender = getAddress();
+    if (hopAcks && ack) {
+        queueFrame(fwd, origin, payload, fwd_hop);
+        return;
+    }
+    fwd.message = origin + "||" + fwd_hop + "||0||" + payload;
+    sendMessage(fwd);
+}
+
+// The body a forwarder sends on: unchanged, except that a TRACE probe gets
+// our hop appended.
+String LoRaNode::forwardedBody(const ParsedPacket &pkt, const FrameHeader &hdr) const {
+    String body = hdr.body;
+    if (pkt.channel_name == "TRACE") appendTraceHop(body, pkt);
+    return body;
+}
+
+// A routed frame has reached its destination, whichever engine carried it.
+// Leaves pkt valid, as origin and payload, only if it goes to the host; that
+// is the one place the body is copied out of the RX frame.
+void LoRaNode::deliverRouted(ParsedPacket &pkt, const FrameHeader &hdr) {
+    String origin = hdr.origin;
+    if (pkt.channel_name == "FRAG") {
+        pkt.valid = handleFragment(pkt, origin, hdr.body, hdr.body_len);
+        return;
+    }
+    if (pkt.channel_name == "FSTAT") {
+        handleFragmentStatus(origin, hdr.body);
+        pkt.valid = false;
+        return;
+    }
+    if (pkt.channel_name == "BULK") {
+        pkt.valid = handleBulkFrame(pkt, origin, hdr.body, hdr.body_len);
+        return;
+    }
+    if (pkt.channel_name == "BACK") {
+        handleBulkAck(origin, hdr.body);
+        pkt.valid = false;
+        return;
+    }
+    if (pkt.channel_name == "TRACE") {
+        sendRouted(origin, "TRACR", forwardedBody(pkt, hdr), false);
+        pkt.valid = false;
+        return;
+    }
+    if (pkt.channel_name == "TRACR") handleTraceReply(origin, hdr.body);
+    pkt.sender = origin;
+    pkt.message = hdr.body;
+}
+
+bool LoRaNode::isDuplicate(const String &key) {
+    if (std::find(recent_data.begin(), recent_data.end(), key) != recent_data.end()) return true;
+    if (recent_data.size() < DUP_CACHE_SIZE) {
+        recent_data.push_back(key);
+    } else {
+        recent_data[recentDataIndex] = key;
+        recentDataIndex = (recentDataIndex + 1) % DUP_CACHE_SIZE;
+    }
+    return false;
+}
+
+// ================== FRAGMENTATION ==================
+// Largest message body that keeps a frame within FRAG_MAX_AIRTIME_MS at the
+// current SF and inside the radio FIFO.
+int LoRaNode::maxPayload() const {
+    int overhead = FRAG_HEADER_OVERHEAD + secureOverhead();
+    int frame = MAX_FRAME_LENGTH;
+    while (frame > overhead + FRAG_MIN_PAYLOAD && airtimeMs(frame) > FRAG_MAX_AIRTIME_MS) frame--;
+    return max(frame - overhead, FRAG_MIN_PAYLOAD);
+}
+
+// FRAG body: fid||index||count||total||data. Fragments are sized evenly so the
+// receiver can place any fragment at index * ceil(total / count).
+bool LoRaNode::sendFragmented(const String &dest, const String &message) {
+    int payload = maxPayload();
+    int count = (message.length() + payload - 1) / payload;
+    if (message.length() > FRAG_MAX_MESSAGE || count > FRAG_MAX_COUNT) {
+        ERR("Message of " + String(message.length()) + " bytes is too large to fragment");
+        return false;
+    }
+
+    OutgoingMessage *out = nullptr;
+    for (auto &slot : outgoing) {
+        if (!slot.active) {
+            out = &slot;
+            break;
+        }
+    }
+    if (!out) {
+        WARN("All fragmentation slots busy, dropping message to " + dest);
+        return false;
+    }
+
+    lastDataId = max(millis(), lastDataId + 1);
+    out->active = true;
+    out->dest = dest;
+    out->fid = lastDataId;
+    out->data = message;
+    out->count = count;
+    out->frag_size = (message.length() + count - 1) / count;
+    out->to_send = count == 64 ? ~0ULL : (1ULL << count) - 1;
+    out->deadline = 0;
+    out->rounds = 0;
+
+    INFO("Fragmenting " + String(message.length()) + " bytes to " + dest + " into " +
+         String(count) + " x " + String(out->frag_size));
+    serviceFragments();
+    return true;
+}
+
+bool LoRaNode::handleFragment(ParsedPacket &pkt, const String &origin, const char *payload, int len) {
+    char fid_buf[16];
+    int index, count, total, header;
+    if (sscanf(payload, "%15[^|]||%d||%d||%d||%n", fid_buf, &index, &count, &total, &header) != 4 ||
+        count <= 0 || count > FRAG_MAX_COUNT || index < 0 || index >= count ||
+        total <= 0 || total > FRAG_MAX_MESSAGE) {
+        WARN("Malformed fragment from " + origin);
+        return false;
+    }
+    unsigned long fid = strtoul(fid_buf, nullptr, 10);
+    unsigned long now = millis();
+
+    ReassemblySlot *slot = nullptr;
+    ReassemblySlot *oldest = nullptr;
+    for (auto &s : reassembly) {
+        if (s.active && s.fid == fid && s.origin == origin) {
+            slot = &s;
+            break;
+        }
+        if (!oldest || !s.active || (oldest->active && s.last_update < oldest->last_update)) oldest = &s;
+    }
+    // A fragment that disagrees with its slot on the message size belongs to a
+    // different message under the same id, e.g. from a sender that rebooted;
+    // the slot's bitmap and offsets no longer fit it, so start over.
+    bool fresh = !slot || slot->count != count || slot->total != total;
+    if (!slot) {
+        if (oldest->active && !oldest->complete) {
+            WARN("Reassembly pool full, evicting " + oldest->origin + ":" + String(oldest->fid));
+        }
+        slot = oldest;
+    } else if (fresh) {
+        WARN("Fragment of " + origin + ":" + String(fid) + " does not match the message in progress, restarting it");
+    }
+    if (fresh) {
+        slot->active = true;
+        slot->complete = false;
+        slot->origin = origin;
+        slot->fid = fid;
+        slot->count = count;
+        slot->total = total;
+        slot->frag_size = (total + count - 1) / count;
+        slot->received = 0;
+        slot->last_status = 0;
+    }
+    slot->last_update = now;
+
+    if (slot->complete) {
+        sendFragmentStatus(*slot);  // our final report was lost
+        return false;
+    }
+
+    int offset = index * slot->frag_size;
+    int data_len = min(len - header, slot->total - offset);
+    if (data_len > 0) memcpy(slot->data + offset, payload + header, data_len);
+    slot->received |= 1ULL << index;
+
+    uint64_t all = slot->count == 64 ? ~0ULL : (1ULL << slot->count) - 1;
+    if (slot->received != all) {
+        if (index == slot->count - 1) sendFragmentStatus(*slot);
+        return false;
+    }
+
+    slot->complete = true;
+    stats.messages_reassembled++;
+    sendFragmentStatus(*slot);
+    INFO("Reassembled " + String(slot->total) + " bytes from " + origin);
+
+    String message;
+    message.reserve(slot->total);
+    message.concat(slot->data, slot->total);
+    pkt.channel_name = "DATA";
+    pkt.sender = origin;
+    pkt.message_id = String(fid);
+    pkt.length = slot->total;
+    pkt.message = message;
+    return true;
+}
+
+// FSTAT body: fid||bitmap, the bitmap in hex with bit i set for fragment i.
+void LoRaNode::sendFragmentStatus(ReassemblySlot &slot) {
+    char bitmap[17];
+    sprintf(bitmap, "%08lX%08lX", (unsigned long)(slot.received >> 32), (unsigned long)slot.received);
+    slot.last_status = millis();
+    sendRouted(slot.origin, "FSTAT", String(slot.fid) + "||" + bitmap);
+}
+
+void LoRaNode::handleFragmentStatus(const String &origin, const char *payload) {
+    const char *sep = strstr(payload, "||");
+    if (!sep) return;
+    unsigned long fid = strtoul(payload, nullptr, 10);
+    uint64_t received = strtoull(sep + 2, nullptr, 16);
+
+    for (auto &out : outgoing) {
+        if (!out.active || out.fid != fid || out.dest != origin) continue;
+
+        uint64_t all = out.count == 64 ? ~0ULL : (1ULL << out.count) - 1;
+        uint64_t missing = all & ~received;
+        if (missing == 0) {
+            INFO("Fragmented message " + String(fid) + " delivered to " + origin);
+            out.active = false;
+            out.data = "";
+            return;
+        }
+        if (++out.rounds > FRAG_MAX_ROUNDS) {
+            WARN("Giving up on fragmented message " + String(fid) + " to " + origin);
+            out.active = false;
+            out.data = "";
+            return;
+        }
+        out.to_send = missing;
+        out.deadline = 0;
+        return;
+    }
+}
+
+// Called every loop iteration: feeds fragments into the ACK queue while it
+// has room, re-probes the receiver when its status report is overdue, and
+// reports gaps or expires idle reassembly slots.
+void LoRaNode::serviceFragments() {
+    unsigned long now = millis();
+
+    for (auto &out : outgoing) {
+        if (!out.active) continue;
+
+        bool routed = router->canReach(out.dest);
+        if (out.to_send == 0 || !routed) {
+            if (out.deadline != 0 && (long)(now - out.deadline) < 0) continue;
+            if (out.deadline != 0 && ++out.rounds > FRAG_MAX_ROUNDS) {
+                WARN("Giving up on fragmented message " + String(out.fid) + " to " + out.dest);
+                out.active = false;
+                out.data = "";
+                continue;
+            }
+            out.deadline = now + FRAG_STATUS_WAIT;
+            if (!routed) {
+                router->discover(out.dest);
+                continue;
+            }
+            out.to_send = 1ULL << (out.count - 1);  // the last fragment makes the receiver report
+        }
+
+        bool sent = false;
+        while (out.to_send != 0 && ack_queue.size() < HOP_ACK_QUEUE / 2) {
+            int index = 0;
+            while (!(out.to_send & (1ULL << index))) index++;
+
+            int offset = index * out.frag_size;
+            String body = String(out.fid) + "||" + String(index) + "||" + String(out.count) + "||" +
+                          String(out.data.length()) + "||" + out.data.substring(offset, offset + out.frag_size);
+            if (!sendRouted(out.dest, "FRAG", body)) break;
+
+            out.to_send &= ~(1ULL << index);
+            if (out.rounds == 0) stats.fragments_sent++;
+            else stats.fragments_resent++;
+            sent = true;
+        }
+        if (sent) out.deadline = now + FRAG_STATUS_WAIT;
+    }
+
+    for (auto &slot : reassembly) {
+        if (!slot.active) continue;
+        if (now - slot.last_update > REASSEMBLY_TIMEOUT) {
+            if (!slot.complete) WARN("Reassembly of " + slot.origin + ":" + String(slot.fid) + " timed out");
+            slot.active = false;
+            continue;
+        }
+        if (!slot.complete && now - slot.last_update > FRAG_GAP_TIMEOUT &&
+            now - slot.last_status > FRAG_GAP_TIMEOUT) {
+            sendFragmentStatus(slot);
+        }
+    }
+}
+
+// ================== BULK TRANSFER ==================
+static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static String base64Encode(const uint8_t *data, int len) {
+    String out;
+    out.reserve((len + 2) / 3 * 4);
+    for (int i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out += BASE64_CHARS[(v >> 18) & 0x3F];
+        out += BASE64_CHARS[(v >> 12) & 0x3F];
+        out += i + 1 < len ? BASE64_CHARS[(v >> 6) & 0x3F] : '=';
+        out += i + 2 < len ? BASE64_CHARS[v & 0x3F] : '=';
+    }
+    return out;
+}
+
+static int base64Decode(const char *in, uint8_t *out, int max) {
+    int len = 0, bits = 0;
+    uint32_t acc = 0;
+    for (; *in && *in != '='; in++) {
+        const char *p = strchr(BASE64_CHARS, *in);
+        if (!p) continue;
+        acc = (acc << 6) | (p - BASE64_CHARS);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (len < max) out[len++] = (acc >> bits) & 0xFF;
+        }
+    }
+    return len;
+}
+
+// Which blocks of the window a repair symbol combines, derived from the
+// session and seed so both ends agree without sending the mask.
+static uint32_t bulkRepairMask(unsigned long sid, unsigned long seed, int windowBlocks) {
+    uint32_t x = (uint32_t)(sid ^ (seed * 2654435761UL)) | 1;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    uint32_t all = windowBlocks == 32 ? 0xFFFFFFFFUL : (1UL << windowBlocks) - 1;
+    uint32_t mask = x & all;
+    return mask ? mask : 1UL << (seed % windowBlocks);
+}
+
+static int bulkWindowBlocks(int blocks, int window) {
+    return min(BULK_WINDOW, blocks - window * BULK_WINDOW);
+}
+
+// Streams data to dest in windows of BULK_WINDOW blocks. Source blocks go
+// out as raw text; fountain repair symbols are binary and travel base64
+// encoded, so fountain sessions use 3/4-size blocks to keep frames equal.
+bool LoRaNode::startBulkTransfer(const String &dest, const String &data, bool fountain) {
+    if (bulkTx.active) {
+        WARN("Bulk transfer to " + bulkTx.dest + " still in progress");
+        return false;
+    }
+    if (data.length() == 0 || data.length() > BULK_MAX_TRANSFER) {
+        ERR("Bulk transfer size " + String(data.length()) + " not supported");
+        return false;
+    }
+
+    int block = min(maxPayload() - BULK_HEADER_EXTRA, BULK_BLOCK_MAX);
+    if (fountain) block = block * 3 / 4 / 3 * 3;
+
+    lastDataId = max(millis(), lastDataId + 1);
+    bulkTx.active = true;
+    bulkTx.fountain = fountain;
+    bulkTx.dest = dest;
+    bulkTx.sid = lastDataId;
+    bulkTx.data = data;
+    bulkTx.block_size = block;
+    bulkTx.blocks = (data.length() + block - 1) / block;
+    bulkTx.window = 0;
+    int wb = bulkWindowBlocks(bulkTx.blocks, 0);
+    bulkTx.to_send = wb == 32 ? 0xFFFFFFFFUL : (1UL << wb) - 1;
+    bulkTx.repair_to_send = fountain ? (int)ceil(wb * BULK_REPAIR_RATIO) : 0;
+    bulkTx.next_seed = 1;
+    bulkTx.deadline = 0;
+    bulkTx.rounds = 0;
+    bulkTx.started = millis();
+    bulkTx.frames = 0;
+
+    INFO("Bulk transfer of " + String(data.length()) + " bytes to " + dest + ": " +
+         String(bulkTx.blocks) + " blocks of " + String(block) + (fountain ? ", fountain repair" : ""));
+    return true;
+}
+
+// BULK body: sid||total||block_size||tag||data. tag is s<index> for a source
+// block or r<window>.<seed> for a repair symbol; a trailing '?' asks for the
+// block ACK. Frames skip hop ACKs: the block ACK covers the whole path.
+void LoRaNode::sendBulkFrame(bool source, int index, bool ackRequest) {
+    String tag;
+    String body;
+    if (source) {
+        int offset = index * bulkTx.block_size;
+        tag = "s" + String(index);
+        body = bulkTx.data.substring(offset, offset + bulkTx.block_size);
+    } else {
+        int wb = bulkWindowBlocks(bulkTx.blocks, bulkTx.window);
+        uint32_t mask = bulkRepairMask(bulkTx.sid, index, wb);
+        uint8_t symbol[BULK_BLOCK_MAX] = {0};
+        for (int b = 0; b < wb; b++) {
+            if (!(mask & (1UL << b))) continue;
+            int offset = (bulkTx.window * BULK_WINDOW + b) * bulkTx.block_size;
+            for (int i = 0; i < bulkTx.block_size && offset + i < (int)bulkTx.data.length(); i++) {
+                symbol[i] ^= (uint8_t)bulkTx.data[offset + i];
+            }
+        }
+        tag = "r" + String(bulkTx.window) + "." + String(index);
+        body = base64Encode(symbol, bulkTx.block_size);
+    }
+    if (ackRequest) tag += "?";
+
+    String frame = String(bulkTx.sid) + "||" + String(bulkTx.data.length()) + "||" +
+                   String(bulkTx.block_size) + "||" + tag + "||" + body;
+    if (sendRouted(bulkTx.dest, "BULK", frame, false)) {
+        bulkTx.frames++;
+        stats.bulk_frames_sent++;
+    }
+}
+
+// Called every loop iteration: sends at most one bulk frame so the RX path
+// and serial bridge keep being serviced between frames.
+void LoRaNode::serviceBulk() {
+    unsigned long now = millis();
+
+    if (bulkTx.active) {
+        int wb = bulkWindowBlocks(bulkTx.blocks, bulkTx.window);
+        bool routed = router->canReach(bulkTx.dest);
+
+        if (bulkTx.deadline != 0 || !routed) {
+            if (bulkTx.deadline == 0 || (long)(now - bulkTx.deadline) >= 0) {
+                if (bulkTx.deadline != 0 && ++bulkTx.rounds > BULK_MAX_ROUNDS) {
+                    WARN("Bulk transfer to " + bulkTx.dest + " abandoned at window " + String(bulkTx.window));
+                    bulkTx.active = false;
+                    bulkTx.data = "";
+                } else if (!routed) {
+                    router->discover(bulkTx.dest);
+                    bulkTx.deadline = now + 4 * airtimeMs(MAX_FRAME_LENGTH) + BULK_ACK_GUARD;
+                } else {
+                    // Block ACK lost or never sent: ask again with one more frame.
+                    bulkTx.deadline = 0;
+                    if (bulkTx.fountain) bulkTx.repair_to_send = 1;
+                    else bulkTx.to_send = 1UL << (wb - 1);
+                }
+            }
+        } else if (bulkTx.to_send != 0) {
+            int b = 0;
+            while (!(bulkTx.to_send & (1UL << b))) b++;
+            bulkTx.to_send &= ~(1UL << b);
+            bool last = bulkTx.to_send == 0 && bulkTx.repair_to_send == 0;
+            sendBulkFrame(true, bulkTx.window * BULK_WINDOW + b, last);
+            if (last) bulkTx.deadline = now + 4 * airtimeMs(MAX_FRAME_LENGTH) + BULK_ACK_GUARD;
+        } else if (bulkTx.repair_to_send > 0) {
+            bool last = --bulkTx.repair_to_send == 0;
+            sendBulkFrame(false, bulkTx.next_seed++, last);
+            if (last) bulkTx.deadline = now + 4 * airtimeMs(MAX_FRAME_LENGTH) + BULK_ACK_GUARD;
+        }
+    }
+
+    if (bulkRx.active && now - bulkRx.last_update > BULK_RX_TIMEOUT) {
+        if (!bulkRx.complete) WARN("Bulk receive from " + bulkRx.origin + " timed out");
+        bulkRx.active = false;
+    }
+}
+
+// BACK body: sid||window||rank||bitmap. rank is how many independent
+// equations the receiver holds for the window; bitmap marks blocks it has
+// as plain source frames.
+void LoRaNode::handleBulkAck(const String &origin, const char *payload) {
+    unsigned long sid, bitmap;
+    int window, rank;
+    if (sscanf(payload, "%lu||%d||%d||%lx", &sid, &window, &rank, &bitmap) != 4) return;
+    if (!bulkTx.active || sid != bulkTx.sid || origin != bulkTx.dest || window != bulkTx.window) return;
+
+    int wb = bulkWindowBlocks(bulkTx.blocks, bulkTx.window);
+    uint32_t all = wb == 32 ? 0xFFFFFFFFUL : (1UL << wb) - 1;
+    bulkTx.deadline = 0;
+
+    if (rank >= wb) {
+        bulkTx.window++;
+        bulkTx.rounds = 0;
+        if (bulkTx.window * BULK_WINDOW >= bulkTx.blocks) {
+            unsigned long elapsed = max(millis() - bulkTx.started, 1UL);
+            float goodput = bulkTx.data.length() * 1000.0 / elapsed;
+            if (sf >= 7 && sf <= 12) stats.bulk_goodput[sf - 7] = goodput;
+            INFO("Bulk transfer to " + bulkTx.dest + " done: " + String(bulkTx.data.length()) +
+                 " bytes in " + String(elapsed) + " ms, " + String(bulkTx.frames) + " frames, " +
+                 String(goodput) + " B/s at SF" + String(sf));
+            bulkTx.active = false;
+            bulkTx.data = "";
+            return;
+        }
+        wb = bulkWindowBlocks(bulkTx.blocks, bulkTx.window);
+        bulkTx.to_send = wb == 32 ? 0xFFFFFFFFUL : (1UL << wb) - 1;
+        bulkTx.repair_to_send = bulkTx.fountain ? (int)ceil(wb * BULK_REPAIR_RATIO) : 0;
+        return;
+    }
+
+    if (++bulkTx.rounds > BULK_MAX_ROUNDS) {
+        WARN("Bulk transfer to " + bulkTx.dest + " abandoned at window " + String(bulkTx.window));
+        bulkTx.active = false;
+        bulkTx.data = "";
+        return;
+    }
+    if (bulkTx.fountain) bulkTx.repair_to_send = wb - rank + 1;
+    else bulkTx.to_send = all & ~bitmap;
+}
+
+void LoRaNode::sendBulkAck(uint16_t window) {
+    uint32_t bitmap = 0;
+    int rank = bulkRx.rank;
+    if (bulkRx.complete || window < bulkRx.window) {
+        rank = BULK_WINDOW;
+        bitmap = 0xFFFFFFFFUL;
+    } else {
+        for (int b = 0; b < BULK_WINDOW; b++) {
+            if (bulkRx.row_mask[b] == (1UL << b)) bitmap |= 1UL << b;
+        }
+    }
+    sendRouted(bulkRx.origin, "BACK", String(bulkRx.sid) + "||" + String(window) + "||" +
+                                      String(rank) + "||" + String(bitmap, HEX));
+}
+
+// Reduces the equation against the existing pivots and keeps it if it adds
+// rank; once the window is full rank, back-substitutes into the data buffer.
+void LoRaNode::insertBulkRow(uint32_t mask, uint8_t *data) {
+    while (mask) {
+        int pivot = __builtin_ctz(mask);
+        if (!bulkRx.row_mask[pivot]) {
+            bulkRx.row_mask[pivot] = mask;
+            memcpy(bulkRx.row_data[pivot], data, bulkRx.block_size);
+            bulkRx.rank++;
+            break;
+        }
+        mask ^= bulkRx.row_mask[pivot];
+        for (int i = 0; i < bulkRx.block_size; i++) data[i] ^= bulkRx.row_data[pivot][i];
+    }
+
+    int wb = bulkWindowBlocks(bulkRx.blocks, bulkRx.window);
+    if (bulkRx.rank < wb) return;
+
+    for (int b = wb - 1; b >= 0; b--) {
+        for (int c = b + 1; c < wb; c++) {
+            if (!(bulkRx.row_mask[b] & (1UL << c))) continue;
+            bulkRx.row_mask[b] ^= bulkRx.row_mask[c];
+            for (int i = 0; i < bulkRx.block_size; i++) bulkRx.row_data[b][i] ^= bulkRx.row_data[c][i];
+        }
+        int offset = (bulkRx.window * BULK_WINDOW + b) * bulkRx.block_size;
+        memcpy(bulkRx.data + offset, bulkRx.row_data[b], min((int)bulkRx.block_size, bulkRx.total - offset));
+    }
+
+    bulkRx.window++;
+    bulkRx.rank = 0;
+    memset(bulkRx.row_mask, 0, sizeof(bulkRx.row_mask));
+    if (bulkRx.window * BULK_WINDOW >= bulkRx.blocks) bulkRx.complete = true;
+}
+
+bool LoRaNode::handleBulkFrame(ParsedPacket &pkt, const String &origin, const char *payload, int len) {
+    char sid_buf[16], tag[24];
+    int total, block_size, header;
+    if (sscanf(payload, "%15[^|]||%d||%d||%23[^|]||%n", sid_buf, &total, &block_size, tag, &header) != 4 ||
+        total <= 0 || total > BULK_MAX_TRANSFER || block_size <= 0 || block_size > BULK_BLOCK_MAX) {
+        WARN("Malformed bulk frame from " + origin);
+        return false;
+    }
+    unsigned long sid = strtoul(sid_buf, nullptr, 10);
+    bool ackRequest = tag[strlen(tag) - 1] == '?';
+
+    int window, index = 0;
+    unsigned long seed = 0;
+    bool source = tag[0] == 's';
+    if (source) {
+        index = atoi(tag + 1);
+        window = index / BULK_WINDOW;
+    } else if (sscanf(tag, "r%d.%lu", &window, &seed) != 2) {
+        return false;
+    }
+
+    if (!bulkRx.active || bulkRx.sid != sid || bulkRx.origin != origin) {
+        if (bulkRx.active && !bulkRx.complete && millis() - bulkRx.last_update < BULK_RX_TIMEOUT) {
+            WARN("Bulk receiver busy with " + bulkRx.origin + ", ignoring " + origin);
+            return false;
+        }
+        if (window != 0) return false;  // joined mid-session, e.g. after a reboot
+        bulkRx.active = true;
+        bulkRx.complete = false;
+        bulkRx.delivered = false;
+        bulkRx.origin = origin;
+        bulkRx.sid = sid;
+        bulkRx.total = total;
+        bulkRx.block_size = block_size;
+        bulkRx.blocks = (total + block_size - 1) / block_size;
+        bulkRx.window = 0;
+        bulkRx.rank = 0;
+        memset(bulkRx.row_mask, 0, sizeof(bulkRx.row_mask));
+        INFO("Bulk receive of " + String(total) + " bytes from " + origin);
+    }
+    bulkRx.last_update = millis();
+
+    if (!bulkRx.complete && window == bulkRx.window) {
+        uint8_t row[BULK_BLOCK_MAX] = {0};
+        uint32_t mask;
+        if (source) {
+            int data_len = min(len - header, (int)bulkRx.block_size);
+            memcpy(row, payload + header, max(data_len, 0));
+            mask = 1UL << (index % BULK_WINDOW);
+        } else {
+            base64Decode(payload + header, row, bulkRx.block_size);
+            mask = bulkRepairMask(sid, seed, bulkWindowBlocks(bulkRx.blocks, window));
+        }
+        insertBulkRow(mask, row);
+    }
+
+    if (ackRequest) sendBulkAck(window);
+
+    // Deliver once: later duplicates only refresh the final block ACK.
+    if (!bulkRx.complete || bulkRx.delivered) return false;
+    bulkRx.delivered = true;
+    INFO("Bulk receive from " + origin + " complete, " + String(bulkRx.total) + " bytes");
+
+    String message;
+    message.reserve(bulkRx.total);
+    message.concat((const char *)bulkRx.data, bulkRx.total);
+    pkt.channel_name = "DATA";
+    pkt.sender = origin;
+    pkt.message_id = String(sid);
+    pkt.length = bulkRx.total;
+    pkt.message = message;
+    return true;
+}
+
+// ================== HOP-BY-HOP ACKS ==================
+void LoRaNode::queueFrame(const ParsedPacket &pkt, const String &origin,
+                          const String &payload, const String &next_hop) {
+    if (ack_queue.size() >= HOP_ACK_QUEUE) {
+        WARN("ACK queue full, dropping DATA " + origin + ":" + pkt.message_id);
+        return;
+    }
+    ack_queue.push_back({pkt, next_hop, origin, payload, 0, 0});
+    serviceAckQueue();
+}
+
+// The timeout covers our frame plus the next hop's forward of it (or its
+// ACK, which is shorter), and doubles on every retry.
+void LoRaNode::transmitPending(PendingFrame &frame) {
+    frame.pkt.sender = getAddress();
+    frame.pkt.message = frame.origin + "||" + frame.next_hop + "||1||" + frame.payload;
+    sendMessage(frame.pkt);
+
+    // A frame held for its channel starts the clock when it actually goes
+    // out; the ACK may have to wait out a phase edge as well.
+    unsigned long timeout = 2 * airtimeMs(lastTxLength) + HOP_ACK_GUARD + (multiChannel() ? MC_GUARD : 0);
+    frame.deadline = max(millis(), lastTxDue) + (timeout << frame.retries) + random(0, HOP_ACK_GUARD);
+}
+
+bool LoRaNode::confirmPending(const String &from, const String &origin, const String &message_id) {
+    for (auto it = ack_queue.begin(); it != ack_queue.end(); ++it) {
+        if (it->deadline == 0 || it->next_hop != from) continue;
+        if (it->origin != origin || it->pkt.message_id != message_id) continue;
+        ack_queue.erase(it);
+        adjustPower(from, -1);
+        return true;
+    }
+    return false;
+}
+
+int LoRaNode::framesInFlight(const String &next_hop) const {
+    int count = 0;
+    for (auto &frame : ack_queue) {
+        if (frame.deadline != 0 && frame.next_hop == next_hop) count++;
+    }
+    return count;
+}
+
+void LoRaNode::sendAck(const String &to, const String &origin, const String &message_id) {
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.channel_name = "ACK";
+    pkt.channel_id = to;
+    pkt.message = origin + "||" + message_id;
+    pkt.length = pkt.message.length();
+    pkt.is_channel = false;
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.message_id = String(millis());
+    sendMessage(pkt);
+}
+
+void LoRaNode::handleAck(const ParsedPacket &pkt) {
+    if (pkt.channel_id != address) return;
+    int sep = pkt.message.indexOf("||");
+    if (sep == -1) return;
+    confirmPending(pkt.sender, pkt.message.substring(0, sep), pkt.message.substring(sep + 2));
+}
+
+// Called every loop iteration: retransmits frames whose ACK timed out, treats
+// an exhausted neighbor as a link break (re-routing its frames over whatever
+// route survives) and fills free window slots.
+void LoRaNode::serviceAckQueue() {
+    unsigned long now = millis();
+
+    std::vector<String> failed;
+    for (auto &frame : ack_queue) {
+        if (frame.deadline == 0 || (long)(now - frame.deadline) < 0) continue;
+        if (std::find(failed.begin(), failed.end(), frame.next_hop) != failed.end()) continue;
+
+        if (frame.retries < HOP_ACK_RETRIES) {
+            frame.retries++;
+            stats.hop_retransmissions++;
+            adjustPower(frame.next_hop, TX_POWER_STEP);
+            DBG("Retransmitting " + frame.origin + ":" + frame.pkt.message_id +
+                " to " + frame.next_hop + " (retry " + String(frame.retries) + ")");
+            transmitPending(frame);
+        } else {
+            failed.push_back(frame.next_hop);
+        }
+    }
+
+    for (auto &hop : failed) {
+        WARN("No ACK from " + hop + " after " + String(HOP_ACK_RETRIES) + " retries");
+        stats.hop_ack_failures++;
+        // Forget the neighbor too, or its HELLO timeout reports the same
+        // break again; its next HELLO brings it back.
+        neighbor_table.erase(hop);
+        router->linkBroken(hop);
+
+        for (auto &frame : ack_queue) {
+            if (frame.next_hop != hop) continue;
+            String next = router->nextHop(frame.pkt.channel_id);
+            if (next.length()) {
+                frame.next_hop = next;
+                frame.retries = 0;
+                frame.deadline = 0;
+            } else {
+                WARN("Dropping DATA " + frame.origin + ":" + frame.pkt.message_id + ", no route left");
+                frame.next_hop = "";
+            }
+        }
+    }
+    ack_queue.erase(std::remove_if(ack_queue.begin(), ack_queue.end(),
+                                   [](const PendingFrame &frame) { return frame.next_hop.length() == 0; }),
+                    ack_queue.end());
+
+    for (auto &frame : ack_queue) {
+        if (frame.deadline == 0 && framesInFlight(frame.next_hop) < HOP_ACK_WINDOW) {
+            transmitPending(frame);
+        }
+    }
+}
+
+// ================== SEND RREQ ==================
+void LoRaNode::sendRREQ(const String &dest, int ttl) {
+    broadcastCounter++;
+    sequenceNumber++;
+    stats.rreq_sent++;
+    unsigned long dest_seq = routing_table.count(dest) ? routing_table[dest].sequence_number : 0;
+    RREQPacket rreq{getAddress(), dest, getAddress(), "-", sequenceNumber, dest_seq,
+                    broadcastCounter, 0, ttl, 0};
+
+    INFO("Sending RREQ to " + dest);
+    DBG("  src_seq=" + String(rreq.source_seq) +
+        " dest_seq=" + String(rreq.dest_seq) +
+        " bcast_id=" + String(rreq.broadcast_id));
+
+    broadcastRREQ(rreq);
+    printRoutingTable();
+}
+
+void LoRaNode::broadcastRREQ(const RREQPacket &rreq) {
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.channel_name = "RREQ";
+    pkt.channel_id = rreq.destination;
+    pkt.message = rreq.source + "||" + String(rreq.source_seq) + "||" + String(rreq.dest_seq) + "||" +
+                  String(rreq.broadcast_id) + "||" + String(rreq.hop_count) + "||" +
+                  String(rreq.ttl) + "||" + String(rreq.metric) + "||" + rreq.first_hop;
+    pkt.length = pkt.message.length();
+    pkt.is_channel = true;
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.message_id = String(millis());
+    sendMessage(pkt);
+}
+
+// ================== RECEIVE AODV ==================
+void LoRaNode::receiveAODV(const ParsedPacket &pkt) {
+    PROFILE_SCOPE("aodv.receive");
+    if (pkt.channel_name == "RREQ") {
+        char src[16], first[16];
+        unsigned long src_seq, dst_seq;
+        int bcast_id, hop, ttl, metric;
+        if (sscanf(pkt.message.c_str(), "%15[^|]||%lu||%lu||%d||%d||%d||%d||%15s",
+                   src, &src_seq, &dst_seq, &bcast_id, &hop, &ttl, &metric, first) != 8) {
+            WARN("Malformed RREQ from " + pkt.sender);
+            return;
+        }
+        RREQPacket rreq{String(src), pkt.channel_id, pkt.sender, String(first),
+                        src_seq, dst_seq, bcast_id, hop, ttl, metric};
+        handleRREQ(rreq);
+    } else if (pkt.channel_name == "RREP") {
+        char dst[16], next[16], last[16];
+        unsigned long dest_seq;
+        int hop, metric, channel;
+        int fields = sscanf(pkt.message.c_str(), "%15[^|]||%lu||%d||%d||%15[^|]||%15[^|]||%d",
+                            dst, &dest_seq, &hop, &metric, next, last, &channel);
+        if (fields < 6) {
+            WARN("Malformed RREP from " + pkt.sender);
+            return;
+        }
+        if (fields == 7 && neighbor_table.count(pkt.sender)) neighbor_table[pkt.sender].home_channel = channel;
+        RREPPacket rrep{String(dst), pkt.channel_id, pkt.sender, String(next), String(last),
+                        dest_seq, hop, metric};
+        handleRREP(rrep);
+    }
+}
+
+// ================== ROUTE SELECTION ==================
+// Fresher sequence numbers always win; between equally fresh routes the
+// lower cumulative ETX wins, so a longer path over solid links beats a
+// shorter one over lossy links.
+bool LoRaNode::isBetterRoute(const String &dest, unsigned long seq, int metric) {
+    auto it = routing_table.find(dest);
+    if (it == routing_table.end() || !it->second.valid) return true;
+    if (seq != it->second.sequence_number) return seq > it->second.sequence_number;
+    return metric < it->second.metric;
+}
+
+// Installs the path as primary when it is better, otherwise keeps it as a
+// backup if it is disjoint from what we already have. Returns false when the
+// path taught us nothing.
+bool LoRaNode::learnRoute(const String &dest, unsigned long seq, const PathEntry &path) {
+    if (isBetterRoute(dest, seq, path.metric)) {
+        installRoute(dest, seq, path);
+        return true;
+    }
+    return addAlternate(dest, seq, path);
+}
+
+// Routes from overheard frames. Those without a sequence number of their own
+// compete on metric at the freshness we already hold (see knownSeq). One that
+// confirms the next hop we already use refreshes the route instead. Routes
+// that were not in use stay passive: they do not speed up HELLOs and are
+// dropped quietly when their link breaks.
+bool LoRaNode::learnOverheard(const String &dest, unsigned long seq, const PathEntry &path) {
+    if (!routeLearning || router == &flood) return false;
+    if (dest == address || path.next_hop == address) return false;
+    if (linkMetric(path.next_hop) > LEARN_MAX_LINK_METRIC) return false;
+
+    auto it = routing_table.find(dest);
+    bool passive = it == routing_table.end() || !it->second.valid || it->second.passive;
+    if (it != routing_table.end() && it->second.valid && it->second.next_hop == path.next_hop &&
+        it->second.sequence_number == seq) {
+        RouteEntry &route = it->second;
+        route.expiration_time = millis() + ROUTE_LIFETIME;
+        if (path.hop_count <= route.hop_count) {
+            route.hop_count = path.hop_count;
+            route.metric = path.metric;
+            route.first_hop = path.first_hop;
+        }
+        return false;
+    }
+
+    if (!learnRoute(dest, seq, path)) return false;
+    routing_table[dest].passive = passive;
+    stats.routes_learned++;
+    DBG("Learned route to " + dest + " via " + path.next_hop +
+        " (ETX " + String(path.metric / (float)METRIC_SCALE) + ")");
+    return true;
+}
+
+unsigned long LoRaNode::knownSeq(const String &dest) const {
+    auto it = routing_table.find(dest);
+    return it == routing_table.end() ? 0 : it->second.sequence_number;
+}
+
+// Replaces the primary path but keeps the precursor list: upstream nodes
+// still route through us no matter which next hop we picked. An equally fresh
+// primary that lost on metric is demoted to a backup.
+void LoRaNode::installRoute(const String &dest, unsigned long seq, const PathEntry &path) {
+    RouteEntry &route = routing_table[dest];
+    bool demote = route.valid && route.sequence_number == seq && route.next_hop != path.next_hop;
+    PathEntry old{route.next_hop, route.first_hop, route.hop_count, route.metric};
+
+    if (!route.valid || route.sequence_number != seq) route.alternates.clear();
+    route.alternates.erase(std::remove_if(route.alternates.begin(), route.alternates.end(),
+                                          [&](const PathEntry &alt) {
+                                              return alt.next_hop == path.next_hop ||
+                                                     alt.first_hop == path.first_hop;
+                                          }),
+                           route.alternates.end());
+
+    route.destination = dest;
+    route.next_hop = path.next_hop;
+    route.first_hop = path.first_hop;
+    route.hop_count = path.hop_count;
+    route.metric = path.metric;
+    route.sequence_number = seq;
+    route.valid = true;
+    route.expiration_time = millis() + ROUTE_LIFETIME;
+    route.passive = false;
+
+    if (demote) addAlternate(dest, seq, old);
+}
+
+bool LoRaNode::addAlternate(const String &dest, unsigned long seq, const PathEntry &path) {
+    auto it = routing_table.find(dest);
+    if (it == routing_table.end() || !it->second.valid) return false;
+    RouteEntry &route = it->second;
+    if (route.sequence_number != seq) return false;
+    if (path.metric > route.metric * ALT_PATH_MAX_STRETCH) return false;
+    if (path.next_hop == route.next_hop || path.first_hop == route.first_hop) return false;
+
+    for (auto &alt : route.alternates) {
+        if (path.next_hop == alt.next_hop || path.first_hop == alt.first_hop) return false;
+    }
+
+    if (route.alternates.size() >= MAX_ALT_PATHS) {
+        if (route.alternates.back().metric <= path.metric) return false;
+        route.alternates.pop_back();
+    }
+    route.alternates.push_back(path);
+    std::sort(route.alternates.begin(), route.alternates.end(),
+              [](const PathEntry &a, const PathEntry &b) { return a.metric < b.metric; });
+    DBG("Backup path to " + dest + " via " + path.next_hop);
+    return true;
+}
+
+// Drops backups through lost_hop and, if the primary used it, switches to the
+// cheapest remaining backup. Returns true when the route is still usable.
+bool LoRaNode::promoteAlternate(RouteEntry &route, const String &lost_hop) {
+    route.alternates.erase(std::remove_if(route.alternates.begin(), route.alternates.end(),
+                                          [&](const PathEntry &alt) { return alt.next_hop == lost_hop; }),
+                           route.alternates.end());
+    if (route.next_hop != lost_hop) return route.valid;
+    if (!route.valid || route.alternates.empty()) return false;
+
+    PathEntry &best = route.alternates.front();
+    INFO("Failover to " + route.destination + ": " + lost_hop + " -> " + best.next_hop);
+    route.next_hop = best.next_hop;
+    route.first_hop = best.first_hop;
+    route.hop_count = best.hop_count;
+    route.metric = best.metric;
+    route.alternates.erase(route.alternates.begin());
+    stats.failovers++;
+    return true;
+}
+
+// With load balancing on, DATA rotates over the primary and every backup
+// within ALT_PATH_MAX_STRETCH of it; otherwise the primary is always used.
+const String &LoRaNode::selectNextHop(RouteEntry &route) {
+    if (!loadBalance || route.alternates.empty()) return route.next_hop;
+
+    unsigned int slot = route.rr_counter++ % (route.alternates.size() + 1);
+    if (slot == 0) return route.next_hop;
+    return route.alternates[slot - 1].next_hop;
+}
+
+void LoRaNode::addPrecursor(const String &dest, const String &precursor) {
+    auto it = routing_table.find(dest);
+    if (it == routing_table.end() || precursor == address) return;
+    std::vector<String> &list = it->second.precursors;
+    if (std::find(list.begin(), list.end(), precursor) == list.end()) list.push_back(precursor);
+}
+
+std::vector<String> LoRaNode::precursorsOf(const std::vector<String> &dests) {
+    std::vector<String> result;
+    for (auto &dest : dests) {
+        auto it = routing_table.find(dest);
+        if (it == routing_table.end()) continue;
+        for (auto &p : it->second.precursors) {
+            if (std::find(result.begin(), result.end(), p) == result.end()) result.push_back(p);
+        }
+    }
+    return result;
+}
+
+// ================== HANDLE RREQ ==================
+void LoRaNode::handleRREQ(const RREQPacket &rreq) {
+    if (rreq.source == address) return;
+
+    int metric = rreq.metric + linkMetric(rreq.sender);
+    String first_hop = rreq.sender == rreq.source ? address : rreq.first_hop;
+    PathEntry path{rreq.sender, first_hop, rreq.hop_count + 1, metric};
+
+    // Later copies of a flood are re-flooded only when they found a cheaper
+    // path, but every copy may still teach us a disjoint reverse path.
+    String key = rreq.source + "_" + String(rreq.broadcast_id);
+    SeenRREQ *seen = nullptr;
+    for (auto &entry : seen_broadcasts) {
+        if (entry.key == key) {
+            seen = &entry;
+            break;
+        }
+    }
+    bool firstCopy = !seen;
+    bool cheaper = firstCopy || metric < seen->metric;
+    if (firstCopy) {
+        seen = &seen_broadcasts[seenBroadcastNext];
+        seenBroadcastNext = (seenBroadcastNext + 1) % RREQ_SEEN_CACHE;
+        seen->key = key;
+    }
+    if (cheaper) seen->metric = metric;
+
+    bool learned = learnRoute(rreq.source, rreq.source_seq, path);
+    if (!cheaper && !learned) {
+        DBG("Duplicate RREQ ignored from " + rreq.source);
+        return;
+    }
+
+    INFO("Handling RREQ from " + rreq.source + " to " + rreq.destination +
+         " via " + rreq.sender + " (ETX " + String(metric / (float)METRIC_SCALE) + ")");
+
+    if (getAddress() == rreq.destination) {
+        // Answer along the path this copy took, so each disjoint copy yields
+        // its own RREP and the source learns backups too.
+        if (firstCopy) sequenceNumber = max(sequenceNumber, rreq.dest_seq) + 1;
+        INFO("Destination reached (" + address + "), sending RREP");
+        RREPPacket rrep{address, rreq.source, address, rreq.sender, "-", sequenceNumber, 0, 0};
+        sendRREP(rrep);
+        return;
+    }
+
+    // A cached route at least as fresh as the one asked for answers for the
+    // destination and ends the flood here. It must carry a sequence number of
+    // its own: a route only learned from HELLOs or overheard data (seq 0) says
+    // nothing about freshness. One that leads back to the node we heard the
+    // RREQ from would not help.
+    auto cached = routing_table.find(rreq.destination);
+    if (cheaper && cached != routing_table.end() && cached->second.valid && cached->second.sequence_number > 0 &&
+        cached->second.sequence_number >= rreq.dest_seq && cached->second.next_hop != rreq.sender) {
+        answerFromCache(rreq, firstCopy);
+        return;
+    }
+
+    if (!cheaper || rreq.ttl <= 0) return;
+
+    RREQPacket newRREQ = rreq;
+    newRREQ.hop_count++;
+    newRREQ.ttl--;
+    newRREQ.metric = metric;
+    newRREQ.first_hop = first_hop;
+
+    {
+        LOOP_SECTION("rreq.jitter");
+        delay(random(10, 50));
+    }
+    broadcastRREQ(newRREQ);
+    printRoutingTable();
+}
+
+// Intermediate RREP from our route to the destination. The gratuitous RREP
+// gives the destination the route back to the source, which it would
+// otherwise only learn from a flood that reached it.
+void LoRaNode::answerFromCache(const RREQPacket &rreq, bool gratuitous) {
+    RouteEntry &route = routing_table[rreq.destination];
+    INFO("Answering RREQ for " + rreq.destination + " from cache (seq " + String(route.sequence_number) +
+         ", ETX " + String(route.metric / (float)METRIC_SCALE) + ")");
+    RREPPacket rrep{rreq.destination, rreq.source, address, rreq.sender, route.first_hop,
+                    route.sequence_number, route.hop_count, route.metric};
+    addPrecursor(rreq.destination, rreq.sender);
+    addPrecursor(rreq.source, route.next_hop);
+    route.passive = false;
+    stats.cached_rreps++;
+    sendRREP(rrep);
+
+    auto reverse = routing_table.find(rreq.source);
+    if (!gratuitous || !gratuitousRREP || reverse == routing_table.end() || !reverse->second.valid) return;
+    RREPPacket grat{rreq.source, rreq.destination, address, route.next_hop, reverse->second.first_hop,
+                    reverse->second.sequence_number, reverse->second.hop_count, reverse->second.metric};
+    sendRREP(grat);
+}
+
+// ================== HANDLE RREP ==================
+void LoRaNode::handleRREP(const RREPPacket &rrep) {
+    if (rrep.next_hop != address) {
+        // Not on the reverse path, but the route it advertises works for us too.
+        String last_hop = rrep.sender == rrep.destination ? address : rrep.last_hop;
+        learnOverheard(rrep.destination, rrep.dest_seq,
+                       {rrep.sender, last_hop, rrep.hop_count + 1, rrep.metric + linkMetric(rrep.sender)});
+        return;
+    }
+
+    int metric = rrep.metric + linkMetric(rrep.sender);
+    String last_hop = rrep.sender == rrep.destination ? address : rrep.last_hop;
+    PathEntry path{rrep.sender, last_hop, rrep.hop_count + 1, metric};
+    INFO("Received RREP from " + rrep.sender + " for " + rrep.destination +
+         " (ETX " + String(metric / (float)METRIC_SCALE) + ")");
+
+    bool primary = isBetterRoute(rrep.destination, rrep.dest_seq, metric);
+    if (!learnRoute(rrep.destination, rrep.dest_seq, path)) {
+        DBG("RREP for " + rrep.destination + " is no better than current route, ignored");
+        return;
+    }
+    printRoutingTable();
+
+    if (rrep.source == address) return;
+
+    if (!routing_table.count(rrep.source) || !routing_table[rrep.source].valid) {
+        WARN("No reverse route to " + rrep.source + ", dropping RREP");
+        return;
+    }
+
+    // A new primary goes back on our primary reverse path; a backup goes out
+    // on a reverse path no earlier RREP of this discovery used, so the paths
+    // the source ends up with stay disjoint.
+    RouteEntry &reverse = routing_table[rrep.source];
+    std::vector<String> &used = rrep_forwarded[rrep.source + "_" + rrep.destination + "_" + String(rrep.dest_seq)];
+    String reverse_hop;
+    if (primary || std::find(used.begin(), used.end(), reverse.next_hop) == used.end()) {
+        reverse_hop = reverse.next_hop;
+    } else {
+        for (auto &alt : reverse.alternates) {
+            if (std::find(used.begin(), used.end(), alt.next_hop) == used.end()) {
+                reverse_hop = alt.next_hop;
+                break;
+            }
+        }
+    }
+    if (reverse_hop.length() == 0) {
+        DBG("No unused reverse path to " + rrep.source + " for backup RREP");
+        return;
+    }
+    if (std::find(used.begin(), used.end(), reverse_hop) == used.end()) used.push_back(reverse_hop);
+
+    RREPPacket fwd = rrep;
+    fwd.hop_count++;
+    fwd.metric = metric;
+    fwd.next_hop = reverse_hop;
+    fwd.last_hop = last_hop;
+    addPrecursor(rrep.destination, reverse_hop);
+    addPrecursor(rrep.source, rrep.sender);
+    sendRREP(fwd);
+}
+
+// ================== SEND RREP ==================
+void LoRaNode::sendRREP(const RREPPacket &rrep) {
+    INFO("Sending RREP to " + rrep.source + " via " + rrep.next_hop);
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.channel_name = "RREP";
+    pkt.channel_id = rrep.source;
+    pkt.message = rrep.destination + "||" + String(rrep.dest_seq) + "||" + String(rrep.hop_count) + "||" +
+                  String(rrep.metric) + "||" + rrep.next_hop + "||" + rrep.last_hop;
+    // The reverse path carries DATA back to us, so say where we listen.
+    if (channelCount > 1) pkt.message += "||" + String(announcedChannel());
+    pkt.length = pkt.message.length();
+    pkt.is_channel = true;
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.message_id = String(millis());
+    sendMessage(pkt);
+    printRoutingTable();
+}
+
+// ================== LINK BREAK ==================
+// Routes through the lost neighbor fail over to a backup path when they have
+// one. The rest are invalidated and get a local repair attempt with a
+// small-TTL RREQ, so upstream traffic can keep flowing through this node once
+// a detour is found.
+void LoRaNode::handleLinkBreak(const String &next_hop) {
+    WARN("Link to " + next_hop + " broken");
+    std::vector<String> unreachable;
+    for (auto &entry : routing_table) {
+        RouteEntry &route = entry.second;
+        if (promoteAlternate(route, next_hop)) continue;
+        if (route.next_hop != next_hop || !route.valid) continue;
+        route.valid = false;
+        route.sequence_number++;
+        if (route.passive) continue;
+
+        if (route.destination == next_hop || pending_repairs.count(route.destination)) {
+            unreachable.push_back(route.destination);
+            continue;
+        }
+
+        int ttl = min(route.hop_count + LOCAL_REPAIR_TTL_ADD, MAX_HOP);
+        INFO("Attempting local repair to " + route.destination + " (TTL " + String(ttl) + ")");
+        pending_repairs[route.destination] = millis() + LOCAL_REPAIR_WAIT;
+        sendRREQ(route.destination, ttl);
+    }
+
+    if (!unreachable.empty()) sendRERR(unreachable, precursorsOf(unreachable));
+}
+
+// ================== ROUTE ERRORS ==================
+// RERR body: dest:seq,dest:seq,... It goes only to the precursors of the
+// lost routes: unicast when there is one, broadcast when there are several.
+void LoRaNode::sendRERR(const std::vector<String> &dests, const std::vector<String> &receivers) {
+    if (receivers.empty()) return;
+
+    String list;
+    for (auto &dest : dests) {
+        unsigned long seq = routing_table.count(dest) ? routing_table[dest].sequence_number : 0;
+        String item = dest + ":" + String(seq);
+        if (list.length() + item.length() + 1 > RERR_MAX_LIST) break;
+        if (list.length() > 0) list += ",";
+        list += item;
+    }
+
+    INFO("Sending RERR for " + list + " to " + String((int)receivers.size()) + " precursor(s)");
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.channel_name = "RERR";
+    pkt.channel_id = receivers.size() == 1 ? receivers[0] : String(BROADCAST_ADDRESS);
+    pkt.message = list;
+    pkt.length = pkt.message.length();
+    pkt.is_channel = receivers.size() > 1;
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.message_id = String(millis());
+    sendMessage(pkt);
+    stats.rerr_sent++;
+}
+
+void LoRaNode::handleRERR(const ParsedPacket &pkt) {
+    if (pkt.channel_id != address && pkt.channel_id != BROADCAST_ADDRESS) return;
+
+    std::vector<String> lost;
+    int pos = 0;
+    while (pos < (int)pkt.message.length()) {
+        int comma = pkt.message.indexOf(',', pos);
+        if (comma == -1) comma = pkt.message.length();
+        String item = pkt.message.substring(pos, comma);
+        pos = comma + 1;
+
+        int colon = item.indexOf(':');
+        if (colon == -1) continue;
+        String dest = item.substring(0, colon);
+        unsigned long seq = item.substring(colon + 1).toInt();
+
+        auto it = routing_table.find(dest);
+        if (it == routing_table.end() || !it->second.valid) continue;
+        if (promoteAlternate(it->second, pkt.sender)) continue;
+
+        it->second.valid = false;
+        it->second.sequence_number = max(it->second.sequence_number, seq);
+        lost.push_back(dest);
+    }
+
+    if (lost.empty()) return;
+    WARN("RERR from " + pkt.sender + " invalidated " + String((int)lost.size()) + " route(s)");
+    sendRERR(lost, precursorsOf(lost));
+}
+
+// ================== AIRTIME ==================
+// SX127x time-on-air (Semtech AN1200.13) for explicit header with CRC.
+unsigned long LoRaNode::airtimeMs(int payloadBytes) const {
+    float tsym = (float)(1UL << sf) / LORA_BANDWIDTH * 1000.0;
+    int de = tsym > 16.0 ? 1 : 0;
+    float tpreamble = (LORA_PREAMBLE_LEN + 4.25) * tsym;
+    float num = 8.0 * payloadBytes - 4.0 * sf + 28 + 16;
+    int payloadSymbols = 8 + max((int)ceil(num / (4.0 * (sf - 2 * de))) * LORA_CODING_RATE, 0);
+    return (unsigned long)(tpreamble + payloadSymbols * tsym + 0.5);
+}
+
+// ================== NEIGHBOR TABLE ==================
+// Prior for a neighbor we have no probe history on yet. The SX127x
+// demodulates down to about -7.5 dB SNR at SF7 and 2.5 dB lower per SF step;
+// a link 10 dB above that floor is treated as clean.
+float LoRaNode::snrToDeliveryRatio(float snr) const {
+    float floor_db = -7.5 - 2.5 * (sf - 7);
+    float ratio = (snr - floor_db) / 10.0;
+    return constrain(ratio, 0.1, 1.0);
+}
+
+// dB above what the SF can still decode. Packet SNR stops rising a few dB
+// above the noise floor, so strong links are measured against the 125 kHz
+// sensitivity (-123 dBm at SF7) with RSSI instead.
+float LoRaNode::linkMargin(int rssi, float snr) const {
+    float margin = snr - (-7.5 - 2.5 * (sf - 7));
+    if (snr > 5) margin = max(margin, (float)(rssi - (-123 - 2.5 * (sf - 7))));
+    return margin;
+}
+
+// Open loop from the neighbor's report of our full-power HELLOs, closed by
+// the boost that missed hop ACKs build up.
+int LoRaNode::txPowerFor(const String &neighbor) {
+    if (!adaptivePower || neighbor.length() == 0) return TX_POWER_MAX;
+    auto it = neighbor_table.find(neighbor);
+    if (it == neighbor_table.end() || it->second.reported_margin == TX_MARGIN_UNKNOWN) return TX_POWER_MAX;
+    int level = TX_POWER_MAX - (it->second.reported_margin - TX_POWER_MARGIN) + it->second.power_boost;
+    return constrain(level, TX_POWER_MIN, TX_POWER_MAX);
+}
+
+void LoRaNode::adjustPower(const String &neighbor, int delta) {
+    auto it = neighbor_table.find(neighbor);
+    if (it == neighbor_table.end()) return;
+    it->second.power_boost = constrain(it->second.power_boost + delta, 0, TX_POWER_MAX - TX_POWER_MIN);
+}
+
+void LoRaNode::updateNeighbor(const ParsedPacket &pkt) {
+    auto it = neighbor_table.find(pkt.sender);
+    if (it == neighbor_table.end()) {
+        float prior = snrToDeliveryRatio(pkt.snr);
+        neighbor_table[pkt.sender] = {pkt.sender, prior, prior, pkt.snr, pkt.rssi,
+                                      HELLO_INTERVAL_MAX, 0, 0, millis(), "",
+                                      0, TX_MARGIN_UNKNOWN, 0, 0};
+        DBG("New neighbor " + pkt.sender + " (SNR " + String(pkt.snr) + " dB)");
+    } else {
+        NeighborEntry &n = it->second;
+        n.snr = LINK_EWMA_ALPHA * n.snr + (1.0 - LINK_EWMA_ALPHA) * pkt.snr;
+        n.rssi = pkt.rssi;
+        n.last_heard = millis();
+    }
+
+    // Whatever the frame was, we can reach its sender directly.
+    learnOverheard(pkt.sender, knownSeq(pkt.sender), {pkt.sender, address, 1, linkMetric(pkt.sender)});
+}
+
+int LoRaNode::linkMetric(const String &neighbor) {
+    auto it = neighbor_table.find(neighbor);
+    if (it == neighbor_table.end()) return MAX_LINK_METRIC;
+
+    float p = it->second.delivery_ratio * it->second.reverse_ratio;
+    if (p <= 0.0) return MAX_LINK_METRIC;
+    int etx = (int)(METRIC_SCALE / p + 0.5);
+    return min(etx, MAX_LINK_METRIC);
+}
+
+// ================== HELLO BEACONS ==================
+// HELLO body: seq||interval[:channel]||addr:pct:margin,...[||root:round]
+// where interval is the gap until our next beacon, channel our home data
+// channel when multi-channel is on (0 while we stay on channel 0), pct is how
+// many of that neighbor's HELLOs we received and margin the dB above the
+// decoding floor they arrived with, so each side learns its reverse delivery
+// ratio and how much TX power it can shed. The optional tail is the time-sync beacon.
+void LoRaNode::sendHello() {
+    helloCounter++;
+    if (channelCount > 1) pickHomeChannel();
+
+    String report;
+    for (auto &e : neighbor_table) {
+        String item = e.first + ":" + String((int)(e.second.delivery_ratio * 100 + 0.5)) +
+                      ":" + String((int)floor(e.second.hello_margin));
+        if (report.length() + item.length() + 1 > HELLO_MAX_LIST) break;
+        if (report.length() > 0) report += ",";
+        report += item;
+    }
+
+    ParsedPacket pkt;
+    pkt.sender = getAddress();
+    pkt.channel_name = "HELLO";
+    pkt.channel_id = BROADCAST_ADDRESS;
+    pkt.message = String(helloCounter) + "||" + String(helloInterval) +
+                  (channelCount > 1 ? ":" + String(announcedChannel()) : String("")) + "||" + report;
+    String beacon = syncBeacon();
+    if (beacon.length() > 0) pkt.message += "||" + beacon;
+    pkt.length = pkt.message.length();
+    pkt.is_channel = true;
+    pkt.timestamp_hex = String(meshTime(), HEX);
+    pkt.message_id = String(millis());
+    sendMessage(pkt);
+}
+
+void LoRaNode::handleHello(const ParsedPacket &pkt) {
+    int first = pkt.message.indexOf("||");
+    int second = first == -1 ? -1 : pkt.message.indexOf("||", first + 2);
+    if (second == -1) return;
+    unsigned long seq = pkt.message.substring(0, first).toInt();
+
+    NeighborEntry &n = neighbor_table[pkt.sender];
+    String interval = pkt.message.substring(first + 2, second);
+    n.hello_interval = constrain((unsigned long)interval.toInt(),
+                                 (unsigned long)HELLO_INTERVAL_MIN, (unsigned long)HELLO_INTERVAL_MAX);
+    int colon = interval.indexOf(':');
+    n.home_channel = colon == -1 ? 0 : interval.substring(colon + 1).toInt();
+
+    if (n.last_hello_seq != 0 && seq > n.last_hello_seq) {
+        unsigned long missed = min(seq - n.last_hello_seq - 1, 10UL);
+        for (unsigned long i = 0; i < missed; i++) n.delivery_ratio *= LINK_EWMA_ALPHA;
+    }
+    n.delivery_ratio = LINK_EWMA_ALPHA * n.delivery_ratio + (1.0 - LINK_EWMA_ALPHA);
+    float margin = linkMargin(pkt.rssi, pkt.snr);
+    n.hello_margin = n.last_hello_seq == 0 ? margin : LINK_EWMA_ALPHA * n.hello_margin + (1.0 - LINK_EWMA_ALPHA) * margin;
+    n.last_hello_seq = seq;
+    n.last_hello_time = millis();
+
+    int third = pkt.message.indexOf("||", second + 2);
+    String report = pkt.message.substring(second + 2, third == -1 ? pkt.message.length() : third);
+    if (third != -1) handleSyncBeacon(pkt, pkt.message.substring(third + 2));
+    else n.time_root = "";
+
+    // Our entry gives the reverse ratio; the others are two-hop routes via
+    // the sender. Only the sender's half of that far link is reported, so its
+    // ETX is estimated as if the link were symmetric.
+    int pos = 0;
+    while (pos < (int)report.length()) {
+        int comma = report.indexOf(',', pos);
+        if (comma == -1) comma = report.length();
+        String item = report.substring(pos, comma);
+        pos = comma + 1;
+        int colon = item.indexOf(':');
+        if (colon == -1) continue;
+        String dest = item.substring(0, colon);
+        int pct = item.substring(colon + 1).toInt();
+        if (dest == address) {
+            n.reverse_ratio = pct / 100.0;
+            int tail = item.indexOf(':', colon + 1);
+            n.reported_margin = tail == -1 ? TX_MARGIN_UNKNOWN : item.substring(tail + 1).toInt();
+        } else if (pct >= LEARN_MIN_REPORT) {
+            float p = pct / 100.0;
+            int far_link = min((int)(METRIC_SCALE / (p * p) + 0.5), MAX_LINK_METRIC);
+            learnOverheard(dest, knownSeq(dest), {pkt.sender, pkt.sender, 2, linkMetric(pkt.sender) + far_link});
+        }
+    }
+}
+
+// Called every loop iteration: detects silent neighbors, resolves pending
+// local repairs and sends our own HELLO when it is due.
+void LoRaNode::refreshNeighbors() {
+    unsigned long now = millis();
+
+    std::vector<String> lost;
+    for (auto &e : neighbor_table) {
+        NeighborEntry &n = e.second;
+        if (now - n.last_heard > ALLOWED_HELLO_LOSS * n.hello_interval + n.hello_interval / 4) {
+            lost.push_back(e.first);
+            continue;
+        }
+        // An interval with nothing at all heard counts as a lost HELLO.
+        // Advancing the expected seq keeps the gap check in handleHello from
+        // counting the same loss twice.
+        if (n.last_hello_time != 0 && now - n.last_hello_time > n.hello_interval * 3 / 2) {
+            if (now - n.last_heard > n.hello_interval) {
+                n.delivery_ratio *= LINK_EWMA_ALPHA;
+                n.last_hello_seq++;
+            }
+            n.last_hello_time += n.hello_interval;
+        }
+    }
+    for (auto &addr : lost) {
+        WARN("Neighbor " + addr + " missed " + String(ALLOWED_HELLO_LOSS) + " HELLOs");
+        neighbor_table.erase(addr);
+        router->linkBroken(addr);
+    }
+
+    for (auto it = pending_repairs.begin(); it != pending_repairs.end(); ) {
+        if (routing_table.count(it->first) && routing_table[it->first].valid) {
+            INFO("Local repair to " + it->first + " succeeded");
+            it = pending_repairs.erase(it);
+        } else if ((long)(now - it->second) >= 0) {
+            WARN("Local repair to " + it->first + " failed");
+            std::vector<String> dest{it->first};
+            it = pending_repairs.erase(it);
+            sendRERR(dest, precursorsOf(dest));
+        } else {
+            ++it;
+        }
+    }
+
+    checkTimeSync();
+
+    if ((long)(now - nextHelloTime) < 0) return;
+
+    // Beacon fast while we carry routes, back off exponentially when idle.
+    bool active = false;
+    for (auto &e : routing_table) active |= e.second.valid && !e.second.passive;
+    helloInterval = active ? HELLO_INTERVAL_MIN : min(helloInterval * 2, (unsigned long)HELLO_INTERVAL_MAX);
+
+    // Any frame we sent since the last beacon already told neighbors we are
+    // alive; skip the beacon, but only a few in a row so link-quality samples
+    // still keep flowing. On a data channel only its receiver heard us. A
+    // beacon with a sync round to pass on always goes out (every one does on
+    // the root), or the mesh's time root would time out while it is busy.
+    bool newRound = syncRoot == address || syncRound != beaconRound;
+    if (!multiChannel() && !newRound && (long)(lastTxTime - lastHelloTime) > 0 &&
+        suppressedHellos < HELLO_MAX_SUPPRESS) {
+        suppressedHellos++;
+    } else {
+        suppressedHellos = 0;
+        sendHello();
+    }
+    lastHelloTime = millis();
+    nextHelloTime = lastHelloTime + helloInterval + random(0, helloInterval / 4);
+}
+
+// ================== TRAFFIC GENERATOR ==================
+// Built-in load generator and sink for throughput and saturation runs.
+// messageInterval is the mean gap between frames: fixed for CONSTANT,
+// exponentially distributed for POISSON, and for BURST the bursts of `burst`
+// back-to-back frames are spaced so the average rate stays the same.
+static const char *const trafficPatterns[] = {"constant", "poisson", "burst"};
+
+void LoRaNode::startTraffic(const String &dests, unsigned long interval, int size,
+                            uint8_t pattern, int burst) {
+    traffic.dests = dests;
+    traffic.size = size;
+    traffic.pattern = pattern <= TRAFFIC_BURST ? pattern : TRAFFIC_CONSTANT;
+    traffic.burst = max(burst, 1);
+    traffic.burst_left = 0;
+    traffic.seq = 0;
+    traffic.sent = 0;
+    traffic.no_route = 0;
+    traffic.started = millis();
+    setMessageInterval(interval);
+    INFO("Traffic to " + dests + ": " + String(size) + " B every " + String(interval) + " ms (" +
+         trafficPatterns[traffic.pattern] + ")");
+}
+
+// Called every loop iteration; sends the next generator frame when it is due.
+void LoRaNode::serviceTraffic() {
+    if (messageInterval == 0 || (long)(millis() - traffic.next_time) < 0) return;
+
+    std::vector<String> choices;
+    if (traffic.dests == "*") {
+        for (auto &e : routing_table) {
+            if (e.second.valid) choices.push_back(e.first);
+        }
+        for (auto &e : neighbor_table) {
+            if (std::find(choices.begin(), choices.end(), e.first) == choices.end()) choices.push_back(e.first);
+        }
+    } else {
+        int pos = 0;
+        while (pos < (int)traffic.dests.length()) {
+            int comma = traffic.dests.indexOf(',', pos);
+            if (comma == -1) comma = traffic.dests.length();
+            if (comma > pos) choices.push_back(traffic.dests.substring(pos, comma));
+            pos = comma + 1;
+        }
+    }
+
+    if (choices.empty()) {
+        traffic.no_route++;
+    } else {
+        String dest = choices[random(0, choices.size())];
+        traffic.seq++;
+        String payload = "GEN|" + String(traffic.seq) + "|" + String(meshTime(), HEX) + "|";
+        int size = min(traffic.size, maxPayload());
+        while ((int)payload.length() < size) payload += (char)('a' + payload.length() % 26);
+
+        if (dest == BROADCAST_ADDRESS) {
+            ParsedPacket pkt;
+            pkt.sender = getAddress();
+            pkt.channel_name = "DATA";
+            pkt.channel_id = BROADCAST_ADDRESS;
+            pkt.message = payload;
+            sendChannel(pkt);
+            traffic.sent++;
+        } else if (sendRouted(dest, "DATA", payload)) {
+            traffic.sent++;
+        } else {
+            traffic.no_route++;
+        }
+    }
+
+    unsigned long gap = messageInterval;
+    if (traffic.pattern == TRAFFIC_POISSON) {
+        gap = (unsigned long)(-log(random(1, 10001) / 10001.0) * messageInterval);
+    } else if (traffic.pattern == TRAFFIC_BURST) {
+        gap = ++traffic.burst_left < traffic.burst ? 0 : messageInterval * traffic.burst;
+        if (gap > 0) traffic.burst_left = 0;
+    }
+    // Keep the offered rate when a send blocked for a while, but don't try
+    // to catch up on more than a few frames.
+    traffic.next_time += gap;
+    if ((long)(millis() - traffic.next_time) > (long)(4 * messageInterval)) traffic.next_time = millis();
+}
+
+// Sink side: counts generator frames per origin. Latency needs the mesh clock
+// and is only taken when the frame's own latency could be computed.
+void LoRaNode::observeTraffic(const ParsedPacket &pkt) {
+    int seq_end = pkt.message.indexOf('|', 4);
+    int time_end = seq_end == -1 ? -1 : pkt.message.indexOf('|', seq_end + 1);
+    if (time_end == -1) return;
+    unsigned long seq = strtoul(pkt.message.c_str() + 4, nullptr, 10);
+    unsigned long gen_time = strtoul(pkt.message.c_str() + seq_end + 1, nullptr, 16);
+
+    if (!traffic_sources.count(pkt.sender) && traffic_sources.size() >= TRAFFIC_MAX_SOURCES) return;
+    TrafficSource &src = traffic_sources[pkt.sender];
+    unsigned long now = millis();
+    if (src.received == 0) {
+        src.first_seq = src.max_seq = seq;
+        src.first_time = now;
+    } else if (seq < src.max_seq) {
+        src.reordered++;
+    }
+    src.first_seq = min(src.first_seq, seq);
+    src.max_seq = max(src.max_seq, seq);
+    src.received++;
+    src.bytes += pkt.message.length();
+    src.last_time = now;
+
+    if (pkt.latency_ms < 0) return;
+    long latency = (long)(meshTime(rxLocalTime(pkt)) - gen_time);
+    if (traffic_latency.size() < TRAFFIC_LATENCY_SAMPLES) {
+        traffic_latency.push_back(latency);
+    } else {
+        traffic_latency[trafficLatencyIndex] = latency;
+        trafficLatencyIndex = (trafficLatencyIndex + 1) % TRAFFIC_LATENCY_SAMPLES;
+    }
+}
+
+void LoRaNode::resetTrafficSink() {
+    traffic_sources.clear();
+    traffic_latency.clear();
+    trafficLatencyIndex = 0;
+}
+
+void LoRaNode::printTraffic() {
+    LOOP_SECTION("print");
+    Serial.println("\n[DBG]========== TRAFFIC (" + address + ") ==========");
+    if (messageInterval > 0) {
+        float elapsed = max(millis() - traffic.started, 1UL) / 1000.0;
+        Serial.println("[DBG]Generator: " + traffic.dests +
+                       " | " + trafficPatterns[traffic.pattern] +
+                       " | Every: " + String(messageInterval) + " ms" +
+                       " | Size: " + String(min(traffic.size, maxPayload())) + " B" +
+                       " | Sent: " + String(traffic.sent) +
+                       " | No route: " + String(traffic.no_route) +
+                       " | Offered: " + String(traffic.sent / elapsed) + " fps");
+    }
+    for (auto &e : traffic_sources) {
+        const TrafficSource &src = e.second;
+        unsigned long expected = src.max_seq - src.first_seq + 1;
+        unsigned long lost = expected > src.received ? expected - src.received : 0;
+        float span = max(src.last_time - src.first_time, 1UL) / 1000.0;
+        Serial.println("[DBG]From: " + e.first +
+                       " | Rx: " + String(src.received) +
+                       " | Lost: " + String(lost) + " (" + String(100.0 * lost / expected, 1) + "%)" +
+                       " | Reordered: " + String(src.reordered) +
+                       " | Goodput: " + String(src.bytes / span) + " B/s");
+    }
+    if (!traffic_latency.empty()) {
+        std::vector<long> sorted = traffic_latency;
+        std::sort(sorted.begin(), sorted.end());
+        auto pct = [&](int p) { return String(sorted[(sorted.size() - 1) * p / 100]); };
+        Serial.println("[DBG]Latency p50/p90/p99: " + pct(50) + " / " + pct(90) + " / " + pct(99) +
+                       " ms (" + String((int)sorted.size()) + " samples)");
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
+
+// ================== FRAME CAPTURE ==================
+// Binary records share the serial port with the text log; the host tool
+// resynchronizes on the magic and drops anything whose CRC does not match.
+// The LoRa library discards payload-CRC failures before we see them, so RX
+// records never carry CAPTURE_FLAG_CRC_ERR today.
+static uint16_t crc16Ccitt(uint16_t crc, const uint8_t *data, size_t len) {
+    while (len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void LoRaNode::captureFrame(const uint8_t *frame, int len, uint8_t flags, int rssi, float snr,
+                            long freq_error, unsigned long timestamp_us) {
+    uint8_t head[2 + CAPTURE_META_LEN];
+    int8_t snr_q = (int8_t)constrain((int)lroundf(snr * 4), -128, 127);
+    head[0] = len & 0xFF;
+    head[1] = len >> 8;
+    head[2] = CAPTURE_VERSION;
+    head[3] = flags;
+    head[4] = sf;
+    head[5] = (uint8_t)snr_q;
+    head[6] = rssi & 0xFF;
+    head[7] = (rssi >> 8) & 0xFF;
+    head[8] = 0;
+    head[9] = 0;
+    for (int i = 0; i < 4; i++) head[10 + i] = ((uint32_t)freq_error >> (8 * i)) & 0xFF;
+    for (int i = 0; i < 4; i++) head[14 + i] = ((uint32_t)timestamp_us >> (8 * i)) & 0xFF;
+
+    uint16_t crc = crc16Ccitt(0xFFFF, head, sizeof(head));
+    crc = crc16Ccitt(crc, frame, len);
+    uint8_t tail[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+
+    Serial.write((const uint8_t *)"LCAP", 4);
+    Serial.write(head, sizeof(head));
+    Serial.write(frame, len);
+    Serial.write(tail, sizeof(tail));
+}
+
+// Passive receive for the sniffer build: drains the FIFO into a capture
+// record without parsing, routing or answering anything.
+void LoRaNode::sniff(int packetSize, unsigned long irqMicros) {
+    if (packetSize <= 0) return;
+    if (irqMicros == 0) irqMicros = micros();
+
+    int rssi = LoRa.packetRssi();
+    float snr = LoRa.packetSnr();
+    long freq_error = LoRa.packetFrequencyError();
+
+    uint8_t frame[MAX_FRAME_LENGTH];
+    int len = 0;
+    while (LoRa.available() && len < MAX_FRAME_LENGTH) frame[len++] = LoRa.read();
+    captureFrame(frame, len, 0, rssi, snr, freq_error, irqMicros);
+}
+
+// ================== SECURED FRAMES ==================
+// Every frame, routing control included, is sealed with the mesh key when one
+// is set, and anything that does not verify is dropped before parsing.
+static uint64_t packSender(const uint8_t *sender, int len) {
+    uint64_t packed = 0;
+    for (int i = 0; i < len; i++) packed = (packed << 8) | sender[i];
+    return packed;
+}
+
+static void secureNonce(uint8_t nonce[CRYPTO_NONCE_LEN], const uint8_t *sender, int len, uint32_t seq) {
+    memset(nonce, 0, CRYPTO_NONCE_LEN);
+    memcpy(nonce, sender, len);
+    for (int i = 0; i < 4; i++) nonce[8 + i] = seq >> (24 - 8 * i);
+}
+
+bool LoRaNode::setKey(const uint8_t *key) {
+    if (!key) {
+        cipher.clearKey();
+        INFO("Frame encryption off");
+        return true;
+    }
+    if (address.length() > SECURE_MAX_SENDER) {
+        ERR("Address " + address + " is too long for secured frames");
+        return false;
+    }
+    cipher.setKey(key);
+#if defined(ARDUINO_ARCH_ESP32)
+    Preferences store;
+    store.begin("secure", true);
+    txSeq = store.getUInt("seq", 0);
+    store.end();
+#endif
+    reserveSeq();
+    INFO("Frame encryption on: AES-128-CCM, " + String(CRYPTO_TAG_LEN) + "-byte tag, " +
+         String(secureOverhead()) + " bytes per frame");
+    return true;
+}
+
+// Claims the next block of seqs before any of it goes on air.
+void LoRaNode::reserveSeq() {
+    txSeqReserved = txSeq + SECURE_SEQ_RESERVE;
+#if defined(ARDUINO_ARCH_ESP32)
+    Preferences store;
+    store.begin("secure", false);
+    store.putUInt("seq", txSeqReserved);
+    store.end();
+#endif
+}
+
+int LoRaNode::secureOverhead() const {
+    return isSecured() ? 2 + address.length() + 4 + CRYPTO_TAG_LEN : 0;
+}
+
+// The text is already in place after frame.start; the header goes in front
+// and the tag after it.
+void LoRaNode::sealFrame(Frame &frame) {
+    PROFILE_SCOPE("tx.seal");
+    uint8_t *p = (uint8_t *)frame.data;
+    int len = address.length();
+    if (txSeq >= txSeqReserved) reserveSeq();
+    uint32_t seq = txSeq++;
+
+    p[0] = SECURE_FRAME_MARKER;
+    p[1] = len;
+    memcpy(p + 2, address.c_str(), len);
+    for (int i = 0; i < 4; i++) p[2 + len + i] = seq >> (24 - 8 * i);
+
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    secureNonce(nonce, p + 2, len, seq);
+    cipher.seal(nonce, p, frame.start, p + frame.start, frame.len - frame.start, p + frame.len);
+    frame.len += CRYPTO_TAG_LEN;
+}
+
+// Verifies and decrypts in place. On success the text starts at frame.start
+// and frame.len no longer counts the tag.
+bool LoRaNode::openFrame(Frame &frame) {
+    PROFILE_SCOPE("rx.open");
+    uint8_t *p = (uint8_t *)frame.data;
+    if (p[0] != SECURE_FRAME_MARKER) {
+        stats.cleartext_dropped++;
+        return false;
+    }
+    int len = frame.len > 1 ? p[1] : 0;
+    int head = 2 + len + 4;
+    if (len == 0 || len > SECURE_MAX_SENDER || frame.len < head + CRYPTO_TAG_LEN) {
+        stats.auth_failures++;
+        return false;
+    }
+
+    uint32_t seq = 0;
+    for (int i = 0; i < 4; i++) seq = (seq << 8) | p[2 + len + i];
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    secureNonce(nonce, p + 2, len, seq);
+    int text = frame.len - head - CRYPTO_TAG_LEN;
+    if (!cipher.open(nonce, p, head, p + head, text, p + head + text)) {
+        stats.auth_failures++;
+        return false;
+    }
+
+    // Only authenticated seqs move the window, so forgeries cannot push it ahead.
+    ReplayWindow &window = replay_windows[packSender(p + 2, len)];
+    if (window.seen == 0 || seq > window.top) {
+        uint32_t shift = window.seen == 0 ? 32 : seq - window.top;
+        window.seen = (shift >= 32 ? 0 : window.seen << shift) | 1;
+        window.top = seq;
+    } else {
+        uint32_t age = window.top - seq;
+        if (age >= SECURE_REPLAY_WINDOW || (window.seen & (1UL << age))) {
+            stats.replays_dropped++;
+            return false;
+        }
+        window.seen |= 1UL << age;
+    }
+
+    frame.start = head;
+    frame.len = head + text;
+    frame.data[frame.len] = '\0';
+    return true;
+}
+
+// ================== TRACEROUTE ==================
+// TRACE payload: probe_id;hop;hop;... Every forwarder, and finally the
+// destination, appends addr,rssi,snr,hop_ms,queue_ms,backlog for the link it
+// heard the probe on: hop_ms is the mesh-clock latency of that link (-1 if
+// unsynced), queue_ms the time from RX interrupt to relaying, backlog the
+// frames waiting in our ACK queue. The destination returns the record to the
+// origin as TRACR. Probes skip hop ACKs so they stay one frame per hop.
+bool LoRaNode::sendTrace(const String &dest) {
+    traceCounter++;
+    traceDest = dest;
+    traceSentAt = millis();
+    return sendRouted(dest, "TRACE", String(traceCounter), false);
+}
+
+void LoRaNode::setTraceInterval(const String &dest, unsigned long ms) {
+    traceDest = dest;
+    traceInterval = ms;
+    nextTraceTime = millis();
+}
+
+// Called every loop iteration; sends the periodic probe when one is due.
+void LoRaNode::serviceTrace() {
+    if (traceInterval == 0 || (long)(millis() - nextTraceTime) < 0) return;
+    nextTraceTime = millis() + traceInterval;
+    sendTrace(traceDest);
+}
+
+// A record that no longer fits gets a trailing '+' and no further hops.
+void LoRaNode::appendTraceHop(String &record, const ParsedPacket &pkt) const {
+    if (record.endsWith("+")) return;
+    String hop = ";" + address + "," + String(pkt.rssi) + "," + String(pkt.snr, 1) + "," +
+                 String(pkt.hop_latency_ms) + "," + String(millis() - rxLocalTime(pkt)) + "," +
+                 String((int)ack_queue.size());
+    if (record.length() + hop.length() > TRACE_MAX_RECORD) {
+        record += "+";
+        return;
+    }
+    record += hop;
+}
+
+void LoRaNode::handleTraceReply(const String &origin, const String &record) {
+    int sep = record.indexOf(';');
+    unsigned long id = strtoul(record.c_str(), nullptr, 10);
+    String rtt = (origin == traceDest && id == traceCounter) ? String(millis() - traceSentAt) + " ms" : String("?");
+
+    Serial.println("\n[DBG]========== TRACE " + address + " -> " + origin + " (#" + String(id) +
+                   ", RTT " + rtt + ") ==========");
+    while (sep != -1) {
+        int next = record.indexOf(';', sep + 1);
+        String hop = record.substring(sep + 1, next == -1 ? record.length() : next);
+        String fields[6];
+        int pos = 0;
+        for (int i = 0; i < 6; i++) {
+            int comma = hop.indexOf(',', pos);
+            fields[i] = hop.substring(pos, comma == -1 ? hop.length() : comma);
+            if (comma == -1) break;
+            pos = comma + 1;
+        }
+        Serial.println("[DBG]Hop: " + fields[0] +
+                       " | RSSI: " + fields[1] +
+                       " | SNR: " + fields[2] +
+                       " | Link: " + fields[3] + " ms" +
+                       " | Queue: " + fields[4] + " ms" +
+                       " | Backlog: " + fields[5]);
+        sep = next;
+    }
+    if (record.endsWith("+")) Serial.println("[DBG](record truncated)");
+    Serial.println("[DBG]=====================================================\n");
+}
+
+// ================== MULTI-CHANNEL ==================
+// One SX127x hears one channel at a time, so the mesh clock is the
+// rendezvous: channel 0 for the control window at the start of every
+// superframe, each node's home data channel for the rest of it.
+
+bool LoRaNode::setChannels(int count) {
+    if (count < 1 || count > MC_MAX_CHANNELS) return false;
+    channelCount = count;
+    // Spread initial homes by address; HELLOs then move nodes off crowded ones.
+    unsigned long hash = 0;
+    for (size_t i = 0; i < address.length(); i++) hash = hash * 31 + address[i];
+    homeChannel = count > 1 ? 1 + hash % (count - 1) : 0;
+    if (count > 1) INFO("Multi-channel: " + String(count) + " channels, home " + String(homeChannel));
+    return true;
+}
+
+// Every node boots as its own time root, which only becomes the rendezvous
+// once some neighbor follows its clock. A node that has been synced stays in
+// phase: losing its root freezes the clock where it was.
+bool LoRaNode::multiChannel() const {
+    if (channelCount <= 1) return false;
+    if (meshClockSet) return true;
+    for (auto &e : neighbor_table) {
+        if (e.second.time_root == address) return true;
+    }
+    return false;
+}
+
+// The data channel we tell neighbors about. 0 means we stay on channel 0
+// throughout, which we do until every neighbor follows our time root too, so
+// nodes still syncing are never cut off.
+int LoRaNode::announcedChannel() const {
+    if (!multiChannel()) return 0;
+    for (auto &e : neighbor_table) {
+        if (e.second.time_root != syncRoot) return 0;
+    }
+    return homeChannel;
+}
+
+int LoRaNode::listenChannel() const {
+    if (!multiChannel()) return 0;
+    return meshTime() % MC_SUPERFRAME < MC_CONTROL_WINDOW ? 0 : announcedChannel();
+}
+
+// Channel a frame can go out on now, or -1 with wait set to the ms until its
+// phase opens. Broadcasts wait for the window; unicasts go to the receiver's
+// announced channel outside it. Frames must finish MC_GUARD before their
+// phase ends, and data-phase unicasts start MC_GUARD after the window so late
+// receivers have retuned.
+int LoRaNode::txChannel(const ParsedPacket &pkt, unsigned long airtime, unsigned long &wait) {
+    if (!multiChannel()) return 0;
+    unsigned long phase = meshTime() % MC_SUPERFRAME;
+    String peer = unicastPeer(pkt);
+    int home = 0;
+    if (peer.length()) {
+        auto it = neighbor_table.find(peer);
+        if (it != neighbor_table.end() && it->second.home_channel < channelCount) home = it->second.home_channel;
+    }
+
+    if (phase < MC_CONTROL_WINDOW) {
+        if (phase + airtime + MC_GUARD <= MC_CONTROL_WINDOW) return 0;
+        wait = (peer.length() ? MC_CONTROL_WINDOW + MC_GUARD : MC_SUPERFRAME) - phase;
+        return -1;
+    }
+    if (peer.length() && phase < MC_CONTROL_WINDOW + MC_GUARD) {
+        wait = MC_CONTROL_WINDOW + MC_GUARD - phase;
+        return -1;
+    }
+    if (peer.length() && phase + airtime + MC_GUARD <= MC_SUPERFRAME) return home;
+    wait = MC_SUPERFRAME - phase;
+    return -1;
+}
+
+void LoRaNode::tuneRadio(int channel) {
+    if (channel == radioChannel) return;
+    LoRa.idle();
+    LoRa.setFrequency(baseFrequency + (long)channel * MC_CHANNEL_SPACING);
+    radioChannel = channel;
+}
+
+// Broadcasts are spread over the whole window so a neighborhood does not
+// key up the moment it opens.
+void LoRaNode::deferFrame(const ParsedPacket &pkt, unsigned long wait, unsigned long airtime) {
+    if (deferred.size() >= MC_DEFER_QUEUE) {
+        WARN("Channel queue full, dropping " + pkt.channel_name);
+        return;
+    }
+    long room = MC_CONTROL_WINDOW - MC_GUARD - (long)airtime;
+    unsigned long spread = unicastPeer(pkt).length() ? random(0, MC_GUARD) : random(0, max(room, 1L));
+    lastTxDue = millis() + wait + spread;
+    deferred.push_back({pkt, lastTxDue});
+    stats.channel_deferrals++;
+}
+
+// Called every loop iteration: follows the superframe with the receiver and
+// sends at most one held frame whose phase has opened.
+void LoRaNode::serviceChannels() {
+    int listen = listenChannel();
+    if (listen != radioChannel) {
+        tuneRadio(listen);
+        LoRa.receive();
+    }
+    unsigned long now = millis();
+    for (auto it = deferred.begin(); it != deferred.end(); ++it) {
+        if ((long)(now - it->due) < 0) continue;
+        ParsedPacket pkt = it->pkt;
+        deferred.erase(it);
+        sendMessage(pkt);  // holds it again if the phase closed in the meantime
+        return;
+    }
+}
+
+// Moves our home to the channel fewest neighbors listen on when that saves
+// at least MC_SWITCH_MARGIN of them; the next HELLO announces it.
+void LoRaNode::pickHomeChannel() {
+    int load[MC_MAX_CHANNELS] = {};
+    for (auto &e : neighbor_table) {
+        int c = e.second.home_channel;
+        if (c > 0 && c < channelCount) load[c]++;
+    }
+    int best = homeChannel;
+    for (int c = 1; c < channelCount; c++) {
+        if (load[c] < load[best]) best = c;
+    }
+    if (best != homeChannel && load[best] + MC_SWITCH_MARGIN <= load[homeChannel]) {
+        INFO("Home channel " + String(homeChannel) + " -> " + String(best) +
+             " (" + String(load[homeChannel]) + " vs " + String(load[best]) + " neighbors)");
+        homeChannel = best;
+    }
+}
+
+// ================== MESH TIME SYNC ==================
+// FTSP-style: the lowest address heard is the time root and bumps a round
+// number on each of its HELLOs. Synced nodes repeat root:round on their own
+// HELLOs. Every frame already carries the sender's mesh clock at TX start, so
+// the first HELLO announcing a new round gives one (local RX time, mesh time)
+// sample; a least-squares fit over the last few samples gives offset and drift.
+
+unsigned long LoRaNode::meshTime(unsigned long local) const {
+    return local + clockOffset + (long)(clockSkew * (long)(local - clockAnchor));
+}
+
+bool LoRaNode::isTimeSynced() const {
+    return syncRoot == address || syncCount >= TIME_SYNC_MIN_SAMPLES;
+}
+
+String LoRaNode::syncBeacon() {
+    if (syncRoot == address) syncRound++;
+    beaconRound = syncRound;
+    if (!isTimeSynced()) return "";
+    return syncRoot + ":" + String(syncRound);
+}
+
+void LoRaNode::handleSyncBeacon(const ParsedPacket &pkt, const String &beacon) {
+    int colon = beacon.indexOf(':');
+    if (colon == -1) return;
+    String root = beacon.substring(0, colon);
+    unsigned long round = strtoul(beacon.c_str() + colon + 1, nullptr, 10);
+    neighbor_table[pkt.sender].time_root = root;
+
+    if (root == address || syncRoot < root) return;
+    if (root == syncRoot && (long)(round - syncRound) <= 0) return;  // round already sampled
+
+    if (root != syncRoot) {
+        INFO("Time root is now " + root + " via " + pkt.sender);
+        syncRoot = root;
+        syncCount = 0;
+        syncIndex = 0;
+    }
+    syncRound = round;
+    lastSyncTime = millis();
+
+    // The sender stamped TX start; its clock has moved on by the airtime when
+    // our RX-done interrupt fires.
+    addSyncSample(rxLocalTime(pkt), pkt.tx_time + airtimeMs(lastRxLength));
+}
+
+void LoRaNode::addSyncSample(unsigned long local, unsigned long global) {
+    long offset = (long)(global - local);
+    if (syncCount >= TIME_SYNC_MIN_SAMPLES && labs((long)(global - meshTime(local))) > TIME_SYNC_MAX_ERROR) {
+        WARN("Mesh clock off by " + String((long)(global - meshTime(local))) + " ms, resyncing");
+        syncCount = 0;
+        syncIndex = 0;
+    }
+    syncLocal[syncIndex] = local;
+    syncOffset[syncIndex] = offset;
+    syncIndex = (syncIndex + 1) % TIME_SYNC_SAMPLES;
+    if (syncCount < TIME_SYNC_SAMPLES) syncCount++;
+    if (syncCount >= TIME_SYNC_MIN_SAMPLES) meshClockSet = true;
+
+    // Work relative to the newest sample so millis() wrap-around cancels out.
+    double mean_x = 0, mean_y = 0;
+    for (int i = 0; i < syncCount; i++) {
+        mean_x += (long)(syncLocal[i] - local);
+        mean_y += syncOffset[i] - offset;
+    }
+    mean_x /= syncCount;
+    mean_y /= syncCount;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < syncCount; i++) {
+        double dx = (long)(syncLocal[i] - local) - mean_x;
+        sxx += dx * dx;
+        sxy += dx * ((syncOffset[i] - offset) - mean_y);
+    }
+    float skew = sxx > 0 ? sxy / sxx : 0;
+    clockSkew = constrain(skew, -TIME_SYNC_MAX_SKEW, TIME_SYNC_MAX_SKEW);
+    clockAnchor = local + (long)mean_x;
+    clockOffset = offset + (long)mean_y;
+}
+
+// Without a new round from the root for a while, take over as root ourselves,
+// freezing the clock where it is so mesh time does not jump.
+void LoRaNode::checkTimeSync() {
+    if (syncRoot == address || millis() - lastSyncTime < TIME_SYNC_TIMEOUT) return;
+    WARN("Lost time root " + syncRoot + ", acting as root");
+    unsigned long now = millis();
+    clockOffset = (long)(meshTime(now) - now);
+    clockAnchor = now;
+    syncRoot = address;
+    syncCount = 0;
+    syncIndex = 0;
+}
+
+// ================== PRINT ROUTING TABLE ==================
+void LoRaNode::printAODVTable() {
+    LOOP_SECTION("print");
+    Serial.println("\n[DBG]========== ROUTING TABLE (" + address + ") ==========");
+    for (auto &e : routing_table) {
+        String alts;
+        for (auto &alt : e.second.alternates) {
+            alts += (alts.length() ? "," : "") + alt.next_hop + "(" + String(alt.metric / (float)METRIC_SCALE) + ")";
+        }
+        Serial.println("[DBG]Dest: " + e.second.destination +
+                       " | NextHop: " + e.second.next_hop +
+                       " | Hops: " + String(e.second.hop_count) +
+                       " | ETX: " + String(e.second.metric / (float)METRIC_SCALE) +
+                       " | Seq: " + String(e.second.sequence_number) +
+                       " | Precursors: " + String((int)e.second.precursors.size()) +
+                       " | Alt: " + (alts.length() ? alts : String("-")) +
+                       " | Valid: " + String(e.second.valid ? (e.second.passive ? "Learned" : "Yes") : "No"));
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
+
+void LoRaNode::printStats() {
+    LOOP_SECTION("print");
+    Serial.println("\n[DBG]========== NODE STATS (" + address + ") ==========");
+    Serial.println("[DBG]TX frames: " + String(stats.tx_frames) +
+                   " | TX airtime: " + String(stats.tx_airtime_ms) + " ms");
+    Serial.println("[DBG]RREQ sent: " + String(stats.rreq_sent) +
+                   " | Failovers: " + String(stats.failovers) +
+                   " | Routes learned: " + String(stats.routes_learned) +
+                   " | Cached RREPs: " + String(stats.cached_rreps));
+    Serial.println("[DBG]Reduced-power TX: " + String(stats.reduced_power_tx) +
+                   " | avg saved: " + String(stats.reduced_power_tx ? stats.tx_power_saved_db / (float)stats.reduced_power_tx : 0.0, 1) +
+                   " dB | TX power: " + String(txPower) + " dBm");
+    Serial.println("[DBG]Channels: " + String(channelCount) +
+                   " | Home: " + String(homeChannel) +
+                   " | Data-channel TX: " + String(stats.data_channel_tx) +
+                   " | Deferred: " + String(stats.channel_deferrals) +
+                   " | Queued: " + String((int)deferred.size()));
+    Serial.println("[DBG]Hop retransmissions: " + String(stats.hop_retransmissions) +
+                   " | ACK failures: " + String(stats.hop_ack_failures) +
+                   " | Duplicates dropped: " + String(stats.duplicates_dropped) +
+                   " | ACK queue: " + String((int)ack_queue.size()));
+    Serial.println("[DBG]Fragments sent: " + String(stats.fragments_sent) +
+                   " | resent: " + String(stats.fragments_resent) +
+                   " | Messages reassembled: " + String(stats.messages_reassembled) +
+                   " | Max payload/frame: " + String(maxPayload()));
+    String goodput;
+    for (int i = 0; i < 6; i++) {
+        if (stats.bulk_goodput[i] > 0) goodput += " SF" + String(i + 7) + "=" + String(stats.bulk_goodput[i]) + "B/s";
+    }
+    Serial.println("[DBG]Bulk frames sent: " + String(stats.bulk_frames_sent) +
+                   " | Goodput:" + (goodput.length() ? goodput : String(" -")));
+    Serial.println("[DBG]RERR sent: " + String(stats.rerr_sent) +
+                   " | Dead-route drops: " + String(stats.dead_route_drops) +
+                   " | Dead-route airtime: " + String(stats.dead_route_airtime_ms) + " ms");
+    Serial.println(String("[DBG]Routing: ") + router->name() +
+                   " | Flood relays: " + String(stats.flood_relayed) +
+                   " | suppressed: " + String(stats.flood_suppressed));
+    Serial.println("[DBG]Tree beacons: " + String(stats.tree_beacons) +
+                   " | Parent changes: " + String(stats.parent_changes) +
+                   " | Loops: " + String(stats.tree_loops));
+    Serial.println("[DBG]Secured: " + String(isSecured() ? "Yes" : "No") +
+                   " | Auth failures: " + String(stats.auth_failures) +
+                   " | Replays dropped: " + String(stats.replays_dropped) +
+                   " | Cleartext dropped: " + String(stats.cleartext_dropped));
+    Serial.println("[DBG]Mesh clock: " + String(meshTime()) + " ms | Root: " + syncRoot +
+                   " | Samples: " + String(syncCount) +
+                   " | Drift: " + String(clockSkew * 1e6) + " ppm" +
+                   " | Synced: " + String(isTimeSynced() ? "Yes" : "No"));
+    Serial.println("[DBG]=====================================================\n");
+}
+
+// Frame pool and heap figures; fragmentation is the share of free heap that
+// is not in the largest free block.
+void LoRaNode::printMemory() {
+    LOOP_SECTION("print");
+    HeapInfo heap = heapInfo();
+    Serial.println("\n[DBG]========== MEMORY (" + address + ") ==========");
+    Serial.println("[DBG]Frame buffers: " + String(frames.inUse()) + "/" + String(FRAME_POOL_SIZE) +
+                   " in use | high water: " + String(frames.highWater()) +
+                   " | exhausted: " + String(frames.exhausted()));
+    if (heap.total > 0) {
+        float frag = heap.free ? 100.0 * (heap.free - heap.largest_free) / heap.free : 0;
+        Serial.println("[DBG]Heap: " + String((unsigned long)heap.free) + "/" + String((unsigned long)heap.total) +
+                       " B free | high water: " + String((unsigned long)(heap.total - heap.min_free)) +
+                       " B | largest block: " + String((unsigned long)heap.largest_free) +
+                       " B | fragmentation: " + String(frag, 1) + "%");
+    } else {
+        Serial.println("[DBG]Heap: not available on this platform");
+    }
+    heapGuardReport();
+    Serial.println("[DBG]=====================================================\n");
+}
+
+void LoRaNode::printNeighborTable() {
+    LOOP_SECTION("print");
+    Serial.println("\n[DBG]========== NEIGHBOR TABLE (" + address + ") ==========");
+    for (auto &e : neighbor_table) {
+        Serial.println("[DBG]Addr: " + e.first +
+                       " | PDR: " + String(e.second.delivery_ratio) +
+                       " | Rev: " + String(e.second.reverse_ratio) +
+                       " | SNR: " + String(e.second.snr) +
+                       " | RSSI: " + String(e.second.rssi) +
+                       " | ETX: " + String(linkMetric(e.first) / (float)METRIC_SCALE) +
+                       " | Margin: " + String(e.second.hello_margin, 1) + "/" +
+                       (e.second.reported_margin == TX_MARGIN_UNKNOWN ? String("-") : String(e.second.reported_margin)) +
+                       " dB | TX: " + String(txPowerFor(e.first)) + " dBm" +
+                       " | Ch: " + String(e.second.home_channel));
+    }
+    Serial.println("[DBG]=====================================================\n");
+}
+
+
+void LoRaNode::refreshAODVTable() {
+    unsigned long currentTime = millis();
+    for (auto it = routing_table.begin(); it != routing_table.end(); ) {
+        if (it->second.expiration_time < currentTime) {
+            INFO("Route to " + it->first + " expired, removing.");
+            it = routing_table.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Discoveries finish well within a heartbeat; forget which reverse paths
+    // their RREPs took.
+    rrep_forwarded.clear();
 }
 
 
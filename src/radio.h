@@ -4,9 +4,190 @@
 #include <Arduino.h>
 #include <LoRa.h>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include "crypto.h"
 
 #define ROUTE_LIFETIME 60000
 #define MAX_HOP 10
+#define RREQ_SEEN_CACHE 32          // RREQ floods remembered for duplicate suppression
+
+#define BROADCAST_ADDRESS "FF"
+
+// ---- Link quality / ETX ----
+#define LINK_EWMA_ALPHA     0.8     // weight kept from history on each update
+#define METRIC_SCALE        100     // route metrics are ETX * METRIC_SCALE
+#define MAX_LINK_METRIC     2000    // ETX 20: treat anything worse as unusable
+
+// ---- HELLO beacons / link-break detection ----
+#define HELLO_INTERVAL_MIN  3000    // ms, used while routes are active
+#define HELLO_INTERVAL_MAX  15000   // ms, idle nodes back off to this
+#define HELLO_MAX_SUPPRESS  3       // beacons our own traffic may stand in for
+#define HELLO_MAX_LIST      160     // bytes of neighbor report carried per HELLO
+#define ALLOWED_HELLO_LOSS  3       // intervals of silence before a link is broken
+#define LOCAL_REPAIR_TTL_ADD 2
+#define LOCAL_REPAIR_WAIT   3000    // ms to wait for a local repair RREP
+
+// ---- Per-link TX power ----
+// HELLOs carry the margin (dB above the demodulation floor) at which each
+// neighbor's beacons arrive. HELLOs and every other broadcast go out at
+// TX_POWER_MAX, so a neighbor's report of us says how much power a unicast to
+// it can shed and still keep TX_POWER_MARGIN. Each missed hop ACK adds
+// TX_POWER_STEP back and each ACK takes 1 dB off again. Off by default, as it
+// trades a little delivery for TX energy.
+#ifndef TX_POWER_ADAPTIVE
+#define TX_POWER_ADAPTIVE   0       // 1 starts with per-link power on; !power on at runtime
+#endif
+#define TX_POWER_MAX        17      // dBm, the LoRa library default on PA_BOOST
+#define TX_POWER_MIN        2       // dBm, lowest PA_BOOST level
+#define TX_POWER_MARGIN     10      // dB kept above the SF's demodulation floor
+#define TX_POWER_STEP       3       // dB added per missed hop ACK
+#define TX_MARGIN_UNKNOWN   -128    // no report from the neighbor yet
+
+// ---- Promiscuous route learning ----
+// Every decoded frame can teach routes: a one-hop route to its sender, two-hop
+// routes from a HELLO's neighbor report, and the advertised route in an RREP
+// on its way to someone else.
+#define LEARN_MAX_LINK_METRIC 400   // ETX 4: links worse than this teach nothing
+#define LEARN_MIN_REPORT    50      // % of HELLOs a neighbor must report hearing from a node
+
+// ---- Multipath ----
+#define MAX_ALT_PATHS       2       // backup next hops kept per destination
+#define ALT_PATH_MAX_STRETCH 2      // alternates may cost at most 2x the primary
+
+// ---- Hop-by-hop ACKs ----
+#define HOP_ACK_RETRIES     3       // retransmissions before the link is declared broken
+#define HOP_ACK_WINDOW      2       // unacknowledged frames in flight per neighbor
+#define HOP_ACK_QUEUE       8       // frames held for ACK or a window slot, all neighbors
+#define HOP_ACK_GUARD       100     // ms of processing slack on top of airtime
+#define DUP_CACHE_SIZE      16      // recent DATA ids remembered for duplicate detection
+
+// ---- Fragmentation ----
+#define MAX_FRAME_LENGTH    255     // SX127x FIFO; LoRaClass::write truncates beyond this
+#define FRAG_MAX_AIRTIME_MS 1500    // per-frame airtime budget fragments are sized to
+#define FRAG_HEADER_OVERHEAD 105    // frame header + TX stamp + routed header + fragment header
+#define FRAG_MIN_PAYLOAD    16
+#define FRAG_MAX_COUNT      64      // fragments per message (one 64-bit bitmap)
+#define FRAG_MAX_MESSAGE    4096    // bytes per reassembled message
+#define FRAG_TX_SLOTS       2       // outgoing fragmented messages in progress
+#define REASSEMBLY_SLOTS    4       // incoming fragmented messages in progress
+#define FRAG_GAP_TIMEOUT    3000    // ms of silence before the receiver reports gaps
+#define FRAG_STATUS_WAIT    8000    // ms the sender waits for a status report
+#define FRAG_MAX_ROUNDS     5       // retransmission rounds before giving up
+#define REASSEMBLY_TIMEOUT  30000   // ms an idle or completed slot is kept
+
+// ---- Bulk transfer ----
+#define BULK_WINDOW         32      // blocks per block-ACK window (one 32-bit bitmap)
+#define BULK_BLOCK_MAX      192     // bytes per block
+#define BULK_MAX_TRANSFER   8192    // bytes per bulk session
+#define BULK_HEADER_EXTRA   8       // bulk header beyond the fragment header budget
+#define BULK_REPAIR_RATIO   0.25    // proactive repair frames per window, fountain mode
+#define BULK_ACK_GUARD      1000    // ms on top of airtime while waiting for a block ACK
+#define BULK_MAX_ROUNDS     8       // unanswered or failed rounds per window before giving up
+#define BULK_RX_TIMEOUT     30000   // ms an idle receive session is kept
+
+// ---- Radio defaults used for airtime estimates ----
+#define LORA_BANDWIDTH      125E3
+#define LORA_CODING_RATE    5       // 4/5
+#define LORA_PREAMBLE_LEN   8
+
+// ---- Traceroute ----
+#define TRACE_MAX_RECORD    150     // bytes of hop records a probe may accumulate
+
+// ---- Traffic generator / sink ----
+#define TRAFFIC_CONSTANT    0
+#define TRAFFIC_POISSON     1
+#define TRAFFIC_BURST       2
+#define TRAFFIC_MAX_SOURCES 8       // origins the sink keeps counters for
+#define TRAFFIC_LATENCY_SAMPLES 128 // recent latencies kept for percentiles
+
+// ---- Frame capture ----
+// Serial record: "LCAP" | u16 len | 16-byte meta | frame | u16 CRC-16/CCITT
+// over len, meta and frame. Meta (little-endian): u8 version, u8 flags,
+// u8 sf, i8 snr in 0.25 dB, i16 rssi, u16 reserved, i32 freq error (Hz),
+// u32 DIO0 timestamp (us). tools/capture2pcap.py turns the stream into pcap.
+#define CAPTURE_VERSION     1
+#define CAPTURE_META_LEN    16
+#define CAPTURE_FLAG_TX     0x01
+#define CAPTURE_FLAG_CRC_ERR 0x02
+#define CAPTURE_FLAG_SECURED 0x04   // sent encrypted; the record holds the cleartext
+#define CAPTURE_FLAG_AUTH_ERR 0x08  // failed decryption; the record holds the air bytes
+
+// ---- Frame encryption ----
+// Secured frame: 0xC5 | u8 sender length | sender | u32 seq (big-endian) |
+// AES-CCM ciphertext of the text frame | CRYPTO_TAG_LEN byte tag. The clear
+// header is authenticated as well. Nonce: sender zero-padded to 8 bytes | seq | 0.
+#define SECURE_FRAME_MARKER 0xC5    // never the first byte of a text frame
+#define SECURE_MAX_SENDER   8
+#define SECURE_REPLAY_WINDOW 32     // late seqs still accepted per sender
+#define SECURE_SEQ_RESERVE  256     // seqs claimed in flash at a time, so a reboot never reuses a nonce
+
+// ---- Mesh time sync ----
+#define TIME_SYNC_SAMPLES     8       // regression table size
+#define TIME_SYNC_MIN_SAMPLES 3       // samples before we count as synced
+#define TIME_SYNC_TIMEOUT     (4 * HELLO_INTERVAL_MAX)  // no new root round -> become root; holds
+                                                        // because new rounds are never suppressed
+#define TIME_SYNC_MAX_ERROR   1000    // ms; larger jumps reset the table
+#define TIME_SYNC_MAX_SKEW    0.001   // clamp on the drift estimate (1000 ppm)
+
+// ---- Multi-channel ----
+// Channel 0 is the base frequency; data channels 1..count-1 sit
+// MC_CHANNEL_SPACING above it. Every node listens on channel 0 for the control
+// window that opens each mesh-time superframe and on its home data channel
+// for the rest. Broadcasts wait for the window; unicasts outside it go out on
+// the receiver's home channel, which HELLOs and RREPs announce. Until mesh
+// time is synced everything stays on channel 0. All nodes need the same count.
+#ifndef MC_CHANNELS
+#define MC_CHANNELS         1       // 1 keeps the mesh on one channel; !channels N at runtime
+#endif
+#define MC_MAX_CHANNELS     8
+#define MC_CHANNEL_SPACING  400000  // Hz
+#define MC_SUPERFRAME       4096    // ms of mesh time; a power of two so millis() wrap keeps the phase
+#define MC_CONTROL_WINDOW   2048    // ms at the start of each superframe spent on channel 0
+#define MC_GUARD            100     // ms kept clear of phase edges for clock error
+#define MC_DEFER_QUEUE      16      // frames held for their channel's next phase
+#define MC_SWITCH_MARGIN    2       // neighbors a quieter channel must shed before we move home
+
+#define RERR_MAX_LIST       200     // bytes of unreachable destinations per RERR
+
+// ---- Routing engines ----
+#define ROUTING_AODV        0
+#define ROUTING_FLOOD       1
+#define ROUTING_COLLECT     2
+#ifndef ROUTING_DEFAULT
+#define ROUTING_DEFAULT     ROUTING_AODV    // -DROUTING_DEFAULT=ROUTING_FLOOD; !routing switches at runtime
+#endif
+
+// ---- Managed flooding ----
+// Flooded frames reuse the routed body with the broadcast address as next hop
+// and the remaining hop budget in the ACK slot: origin||FF||hops_left||payload.
+// Channel messages (is_channel) are always flooded this way, whatever the
+// routing engine. A relay waits longer the better it heard the frame, so the
+// farthest receivers go first and nearer ones hear them and stand down.
+#define FLOOD_HOP_LIMIT     4       // hops a flooded frame may travel
+#define FLOOD_RELAY_QUEUE   8       // relays waiting for their slot
+#define FLOOD_RELAY_SLOTS   4       // relay contention window, in airtimes of the frame
+#define FLOOD_RELAY_GUARD   50      // ms before the earliest relay slot
+#define FLOOD_SUPPRESS_COPIES 2     // relays overheard before we cancel ours; 1 leaves holes in sparse areas
+#define FLOOD_SNR_MIN       -15.0   // dB heard at or below: first slot
+#define FLOOD_SNR_MAX       10.0    // dB heard at or above: last slot
+#define FLOOD_SEEN_CACHE    32      // origin:message_id keys remembered per node
+
+// ---- Collection tree ----
+// The sink advertises cost 0 and every other node its parent's cost plus the
+// ETX of the link to it, in TREE beacons: sink||cost||pull. Beacons follow a
+// Trickle timer that doubles from COLLECT_BEACON_MIN to COLLECT_BEACON_MAX
+// while the tree is stable and drops back on any inconsistency. DATA to the
+// sink climbs the gradient; everything else is left to AODV.
+#define COLLECT_PARENTS     3       // parent plus backups
+#define COLLECT_BEACON_MIN  2000    // ms, Trickle Imin
+#define COLLECT_BEACON_MAX  512000  // ms, Trickle Imax
+#define COLLECT_SWITCH_GAIN 150     // ETX * METRIC_SCALE a backup must beat the parent by
+#define COLLECT_NO_ROUTE    0xFFFF  // cost advertised without a parent
+
+// ---- Frame buffers ----
+#define FRAME_POOL_SIZE     4       // RX frame plus the TX frames the router sends while handling it
+#define FRAME_FIELD_LEN     24      // header field capacity in a FrameHeader, with the NUL
 
 struct ParsedPacket {
     String timestamp_hex;
@@ -18,62 +199,535 @@ struct ParsedPacket {
     bool is_channel;
     String message;
     bool valid;
+
+    // Radio metadata, captured once when the frame arrives
+    int rssi = 0;
+    float snr = 0;
+    long freq_error = 0;            // Hz
+    uint8_t spreading_factor = 0;
+    unsigned long rx_micros = 0;    // DIO0 interrupt time
+
+    // Mesh clock: tx_time is the last hop's stamp at TX start; latencies are
+    // -1 until we and the last hop share a time root.
+    unsigned long tx_time = 0;
+    long hop_latency_ms = -1;
+    long latency_ms = -1;           // since timestamp_hex at the origin
+};
+
+// The one text form of a delivered packet, shared by the serial bridge and
+// storage: the eight frame fields, then
+// sf||rssi||snr||freq_error||rx_micros||hop_latency_ms||latency_ms.
+size_t printPacket(Print &out, const ParsedPacket &pkt);
+
+// A frame in a pool buffer, as text plus the radio metadata it arrived with.
+// Exactly one stage owns it at a time and hands it back with
+// FramePool::release(); nothing in here touches the heap.
+struct Frame {
+    uint16_t len;
+    uint8_t start;                     // text begins here, after a secured frame's header
+    char data[MAX_FRAME_LENGTH + 1];   // NUL-terminated
+    int16_t rssi;
+    float snr;
+    int32_t freq_error;
+    uint32_t rx_micros;
+};
+
+// Fixed set of frame buffers allocated with the node, so steady-state RX and
+// TX never go to the heap. acquire() returns nullptr when every buffer is
+// out; callers drop the frame and the miss is counted.
+class FramePool {
+public:
+    FramePool();
+    Frame *acquire();
+    void release(Frame *frame);
+
+    int inUse() const { return FRAME_POOL_SIZE - free_count; }
+    int highWater() const { return high_water; }
+    unsigned long exhausted() const { return exhausted_count; }
+
+private:
+    Frame frames[FRAME_POOL_SIZE];
+    Frame *free_list[FRAME_POOL_SIZE];
+    int free_count;
+    int high_water = 0;
+    unsigned long exhausted_count = 0;
+};
+
+// Highest seq accepted from a sender, and which of the SECURE_REPLAY_WINDOW
+// seqs below it have been seen (bit i = top - i).
+struct ReplayWindow {
+    uint32_t top;
+    uint32_t seen;
+};
+
+// Header of a text frame with fixed-length fields, parsed in place. payload
+// and body point into the pooled Frame they came from and are only valid while
+// that frame is owned, which for a received frame is until processReceived()
+// returns. Routed frames are consumed from here; nothing copies their body
+// into a String until it is delivered or forwarded.
+struct FrameHeader {
+    char timestamp[FRAME_FIELD_LEN];   // origin stamp, hop stamp stripped
+    unsigned long tx_time;             // last hop's stamp, or the origin's
+    char channel[FRAME_FIELD_LEN];
+    char channel_id[FRAME_FIELD_LEN];
+    char sender[FRAME_FIELD_LEN];
+    char message_id[FRAME_FIELD_LEN];
+    int length;
+    bool is_channel;
+    const char *payload;               // everything after the header, NUL-terminated
+    uint16_t payload_len;
+
+    // Routed body origin||next_hop||flag||body, if the payload is one
+    bool routed;
+    char origin[FRAME_FIELD_LEN];
+    char next_hop[FRAME_FIELD_LEN];
+    int flag;                          // hop-ACK request, or hops left under FLOOD
+    const char *body;                  // tail of payload, NUL-terminated
+    uint16_t body_len;
+};
+
+bool parseFrameHeader(const Frame &frame, FrameHeader &hdr);
+
+struct NeighborEntry {
+    String address;
+    float delivery_ratio;          // EWMA of HELLOs heard from the neighbor
+    float reverse_ratio;           // neighbor's report of how well it hears us
+    float snr;                     // EWMA over every frame overheard
+    int rssi;
+    unsigned long hello_interval;  // interval the neighbor last announced
+    unsigned long last_hello_seq;
+    unsigned long last_hello_time;
+    unsigned long last_heard;
+    String time_root;              // root on the neighbor's last sync beacon
+    float hello_margin;            // EWMA link margin over the neighbor's HELLOs
+    int reported_margin;           // neighbor's report of our HELLOs, or TX_MARGIN_UNKNOWN
+    int power_boost;               // dB added back after missed hop ACKs
+    int home_channel;              // data channel it listens on, 0 if not announced
+};
+
+// One way to reach a destination. first_hop is the hop adjacent to the far
+// end of the path; two paths with different next and first hops share no link
+// at either end.
+struct PathEntry {
+    String next_hop;
+    String first_hop;
+    int hop_count;
+    int metric;
 };
 
 struct RouteEntry {
     String destination;
     String next_hop;
+    String first_hop;
     int hop_count;
+    int metric;                    // cumulative ETX * METRIC_SCALE
     unsigned long sequence_number;
     bool valid;
     unsigned long expiration_time;
+    std::vector<String> precursors;  // upstream neighbors that route through us
+    std::vector<PathEntry> alternates; // link-disjoint backups, cheapest first
+    unsigned int rr_counter;         // round-robin position when load balancing
+    bool passive;                    // learned from overheard frames and not used since
+};
+
+// A frame waiting for the superframe phase its channel is open in.
+struct DeferredFrame {
+    ParsedPacket pkt;
+    unsigned long due;
+};
+
+// A routed DATA frame waiting for its next hop to confirm it, or for a free
+// slot in that neighbor's window (deadline == 0).
+struct PendingFrame {
+    ParsedPacket pkt;
+    String next_hop;
+    String origin;
+    String payload;
+    unsigned long deadline;
+    int retries;
+};
+
+// Sender side of a fragmented message. Fragments are frag_size bytes except
+// the last; to_send holds the ones still to (re)transmit this round.
+struct OutgoingMessage {
+    bool active;
+    String dest;
+    unsigned long fid;
+    String data;
+    uint8_t count;
+    uint16_t frag_size;
+    uint64_t to_send;
+    unsigned long deadline;
+    int rounds;
+};
+
+// Receiver side: fragments land at index * frag_size in any order. Completed
+// slots linger so late duplicates still get a final status report.
+struct ReassemblySlot {
+    bool active;
+    bool complete;
+    String origin;
+    unsigned long fid;
+    uint8_t count;
+    uint16_t frag_size;
+    uint16_t total;
+    uint64_t received;
+    unsigned long last_update;
+    unsigned long last_status;
+    char data[FRAG_MAX_MESSAGE];
+};
+
+// Sender side of a bulk session. Each window is streamed back-to-back and
+// answered by one block ACK; in fountain mode losses are covered by random
+// linear (GF(2)) combinations of the window instead of retransmissions.
+struct BulkSender {
+    bool active;
+    bool fountain;
+    String dest;
+    unsigned long sid;
+    String data;
+    uint16_t block_size;
+    uint16_t blocks;
+    uint16_t window;
+    uint32_t to_send;        // source blocks of this window still to send
+    int repair_to_send;
+    unsigned long next_seed;
+    unsigned long deadline;  // block ACK due; 0 while streaming
+    int rounds;
+    unsigned long started;
+    unsigned long frames;
+};
+
+// Receiver side: every frame of the current window is a GF(2) equation over
+// its blocks, kept in row-echelon form with row i pivoting on block i.
+struct BulkReceiver {
+    bool active;
+    bool complete;
+    bool delivered;
+    String origin;
+    unsigned long sid;
+    uint16_t total;
+    uint16_t block_size;
+    uint16_t blocks;
+    uint16_t window;
+    uint8_t rank;
+    uint32_t row_mask[BULK_WINDOW];
+    uint8_t row_data[BULK_WINDOW][BULK_BLOCK_MAX];
+    uint8_t data[BULK_MAX_TRANSFER];
+    unsigned long last_update;
+};
+
+// Load generator. Payload: GEN|seq|mesh_time_hex|padding up to size bytes.
+struct TrafficGenerator {
+    String dests;                  // comma list; FF broadcasts, * picks any route or neighbor
+    int size;
+    uint8_t pattern;               // TRAFFIC_CONSTANT / POISSON / BURST
+    int burst;                     // frames per burst
+    int burst_left;
+    unsigned long next_time;
+    unsigned long seq;
+    unsigned long sent;
+    unsigned long no_route;        // frames that started a discovery instead
+    unsigned long started;
+};
+
+// Sink counters per generator origin.
+struct TrafficSource {
+    unsigned long first_seq;
+    unsigned long max_seq;
+    unsigned long received;
+    unsigned long reordered;       // arrived after a higher seq
+    unsigned long bytes;
+    unsigned long first_time;
+    unsigned long last_time;
+};
+
+struct NodeStats {
+    unsigned long tx_frames;
+    unsigned long tx_airtime_ms;
+    unsigned long rerr_sent;
+    unsigned long rreq_sent;
+    unsigned long failovers;
+    unsigned long hop_retransmissions;
+    unsigned long hop_ack_failures;
+    unsigned long duplicates_dropped;
+    unsigned long fragments_sent;
+    unsigned long fragments_resent;
+    unsigned long messages_reassembled;
+    unsigned long bulk_frames_sent;
+    float bulk_goodput[6];               // last bytes/s per SF 7..12
+    unsigned long dead_route_drops;      // DATA that reached us with no route onward
+    unsigned long dead_route_airtime_ms; // airtime spent delivering those frames to us
+    unsigned long auth_failures;         // secured frames whose tag did not verify
+    unsigned long replays_dropped;
+    unsigned long cleartext_dropped;     // unencrypted frames heard while we hold a key
+    unsigned long flood_relayed;
+    unsigned long flood_suppressed;      // relays cancelled after overhearing enough copies
+    unsigned long routes_learned;        // installed from overheard frames
+    unsigned long tree_beacons;
+    unsigned long parent_changes;
+    unsigned long tree_loops;            // DATA from our own parent, or from a node no farther out
+    unsigned long cached_rreps;          // RREQs we answered for another destination
+    unsigned long reduced_power_tx;      // frames sent below TX_POWER_MAX
+    unsigned long tx_power_saved_db;     // dB shed, summed over those frames
+    unsigned long data_channel_tx;       // unicasts sent on a neighbor's home channel
+    unsigned long channel_deferrals;     // frames held for their channel's next phase
+};
+
+// Best metric heard so far for one RREQ flood.
+struct SeenRREQ {
+    String key;                    // source_broadcastid
+    int metric;
+};
+
+// A flooded frame held back until its relay slot.
+struct FloodRelay {
+    ParsedPacket pkt;
+    String key;                    // origin:message_id
+    unsigned long due;
+    int hops_left;                 // budget our relay will carry
+    int copies_heard;
+};
+
+// A neighbor we could use as parent toward the sink.
+struct TreeCandidate {
+    String address;
+    int cost;                      // its advertised cost to the sink
 };
 
 struct RREQPacket {
     String source;
     String destination;
+    String sender;                 // last hop the RREQ was heard from
+    String first_hop;              // neighbor of the source this copy went through
     unsigned long source_seq;
     unsigned long dest_seq;
     int broadcast_id;
     int hop_count;
     int ttl;
+    int metric;
 };
 
 struct RREPPacket {
     String destination;
     String source;
+    String sender;                 // last hop the RREP was heard from
+    String next_hop;               // node on the reverse path that should take it
+    String last_hop;               // neighbor of the destination this copy went through
     unsigned long dest_seq;
     int hop_count;
+    int metric;
+};
+
+class LoRaNode;
+
+// ================== ROUTING ENGINES ==================
+// LoRaNode hands every routed frame it sends or receives to the active engine.
+// HELLO, hop ACKs and the payload handlers (fragments, bulk, trace) are shared.
+class RoutingEngine {
+public:
+    virtual ~RoutingEngine() {}
+    virtual const char *name() const = 0;
+    // Sends a routed frame (DATA, FRAG, FSTAT, ...) toward dest; false if it
+    // could not go out now.
+    virtual bool send(const String &dest, const String &channel, const String &message, bool ack) = 0;
+    // Takes routed frames and the engine's own control frames; returns false
+    // for anything else and leaves pkt alone. pkt has the header fields and
+    // radio metadata; a routed frame's body is only in hdr, and goes into
+    // pkt.message if the frame is delivered to the host.
+    virtual bool receive(ParsedPacket &pkt, const FrameHeader &hdr) = 0;
+    virtual void service() {}       // every loop pass
+    virtual void refresh() {}       // heartbeat: expire state
+    virtual void reset() {}         // switched out: drop queued work
+    virtual void linkBroken(const String &) {}
+    // Next hop for a frame whose hop failed, or "" if it must be dropped.
+    virtual String nextHop(const String &) { return ""; }
+    // Whether send() toward a destination can go out now; discover() starts
+    // whatever would make it so. Fragment and bulk senders wait on these.
+    virtual bool canReach(const String &) { return true; }
+    virtual void discover(const String &) {}
+    virtual void printTable() = 0;
+};
+
+// On-demand discovery and ETX-routed unicast; the AODV code lives in LoRaNode.
+class AodvRouting : public RoutingEngine {
+public:
+    explicit AodvRouting(LoRaNode &node) : node(node) {}
+    const char *name() const override { return "AODV"; }
+    bool send(const String &dest, const String &channel, const String &message, bool ack) override;
+    bool receive(ParsedPacket &pkt, const FrameHeader &hdr) override;
+    void refresh() override;
+    void linkBroken(const String &neighbor) override;
+    String nextHop(const String &dest) override;
+    bool canReach(const String &dest) override;
+    void discover(const String &dest) override;
+    void printTable() override;
+
+private:
+    LoRaNode &node;
+};
+
+// Managed flooding: every node relays a frame once, in an SNR-weighted slot,
+// unless it overhears enough relays of it first. No discovery, no
+// per-destination state. Also carries channel messages for the AODV engine.
+class FloodRouting : public RoutingEngine {
+public:
+    explicit FloodRouting(LoRaNode &node) : node(node) {}
+    const char *name() const override { return "FLOOD"; }
+    bool send(const String &dest, const String &channel, const String &message, bool ack) override;
+    bool broadcast(ParsedPacket pkt);   // channel message from the host or the generator
+    bool receive(ParsedPacket &pkt, const FrameHeader &hdr) override;
+    void service() override;
+    void reset() override { relays.clear(); }
+    void printTable() override;
+
+private:
+    LoRaNode &node;
+    std::vector<FloodRelay> relays;
+    std::vector<String> seen;           // origin:message_id ring
+    size_t seenIndex = 0;
+
+    bool seenBefore(const String &key);
+    unsigned long relayDelay(float snr) const;
+};
+
+// Many-to-one collection tree toward a single sink, CTP style. Each node keeps
+// a parent and a couple of backups; DATA for the sink needs no discovery and
+// no per-destination state. Other destinations fall back to AODV.
+class CollectionRouting : public RoutingEngine {
+public:
+    explicit CollectionRouting(LoRaNode &node) : node(node) {}
+    const char *name() const override { return "COLLECT"; }
+    bool send(const String &dest, const String &channel, const String &message, bool ack) override;
+    bool receive(ParsedPacket &pkt, const FrameHeader &hdr) override;
+    void service() override;
+    void refresh() override;
+    void reset() override { trickleInterval = 0; }
+    void linkBroken(const String &neighbor) override;
+    String nextHop(const String &dest) override;
+    bool canReach(const String &dest) override;
+    void discover(const String &dest) override;
+    void printTable() override;
+
+    void setSink(bool enable);
+    bool isSink() const { return sinkNode; }
+
+private:
+    LoRaNode &node;
+    bool sinkNode = false;
+    String sink;                        // address of the sink we follow
+    String parent;                      // parents[0].address, or "" without a feasible one
+    int advertised = COLLECT_NO_ROUTE;  // cost in our last beacon
+    TreeCandidate parents[COLLECT_PARENTS] = {};  // [0] is the parent
+    int parentCount = 0;
+    unsigned long trickleInterval = 0;  // 0 until the first beacon interval starts
+    unsigned long trickleStart = 0;
+    unsigned long trickleFire = 0;
+    bool trickleFired = false;
+
+    int cost();
+    int pathCost(const TreeCandidate &candidate);
+    void handleBeacon(const ParsedPacket &pkt);
+    void sendBeacon();
+    void selectParent();
+    void dropCandidate(const String &neighbor);
+    void forward(const ParsedPacket &pkt, const String &origin, const String &payload, bool ack);
+    void resetTrickle();
+    void startTrickleInterval();
 };
 
 class LoRaNode {
+    friend class AodvRouting;
+    friend class FloodRouting;
+    friend class CollectionRouting;
+
 public:
     LoRaNode(String nodeAddress, int spreadingFactor,
              int sck = 13, int miso = 18, int mosi = 19,
              int ss  = 23, int rst  = 33, int dio0 = 32);
 
     bool begin(long frequency = 915E6);
-    void setMessageInterval(unsigned long ms);
+    void setMessageInterval(unsigned long ms);  // load generator mean interval, 0 stops it
+    void setLoadBalancing(bool enable) { loadBalance = enable; }
+    void setHopAcks(bool enable) { hopAcks = enable; }
+    void setRouteLearning(bool enable) { routeLearning = enable; }
+    void setGratuitousRREP(bool enable) { gratuitousRREP = enable; }
+    void setAdaptivePower(bool enable) { adaptivePower = enable; }
+    bool setChannels(int count);        // 1 .. MC_MAX_CHANNELS, 1 disables multi-channel
+    int channels() const { return channelCount; }
+    void serviceChannels();
 
     void sendMessage(const ParsedPacket &pkt);
-    void processReceived(int packetSize);
+    void processReceived(int packetSize, unsigned long irqMicros = 0);
 
-    void sendDataAODV(const String &dest, const String &message);
+    bool sendData(const String &dest, const String &message);   // false if nothing was sent or queued
+    bool sendRouted(const String &dest, const String &channel, const String &message, bool ack = true);
+    bool setRouting(uint8_t mode);      // ROUTING_AODV / ROUTING_FLOOD / ROUTING_COLLECT
+    void setCollectionSink(bool enable) { collect.setSink(enable); }
+    RoutingEngine &routing() const { return *router; }
+    void serviceRouting();
+    bool sendChannel(const ParsedPacket &pkt) { return flood.broadcast(pkt); }
+    void refreshRoutes() { router->refresh(); }
+    bool sendFragmented(const String &dest, const String &message);
+    void serviceFragments();
+    bool startBulkTransfer(const String &dest, const String &data, bool fountain = false);
+    void serviceBulk();
+    int maxPayload() const;
     void receiveAODV(const ParsedPacket &pkt);
     void handleRREQ(const RREQPacket &rreq);
     void handleRREP(const RREPPacket &rrep);
-    void sendRREQ(const String &dest);
-    void sendRREP(const String &dest, const String &next_hop, int hop_count, int dest_seq); // changed to int
+    void sendRREQ(const String &dest, int ttl = MAX_HOP);
+    void sendRREP(const RREPPacket &rrep);
+    void handleData(ParsedPacket &pkt, const FrameHeader &hdr);
+    void sendAck(const String &to, const String &origin, const String &message_id);
+    void handleAck(const ParsedPacket &pkt);
+    void serviceAckQueue();
     void handleLinkBreak(const String &next_hop);
+    void sendRERR(const std::vector<String> &dests, const std::vector<String> &receivers);
+    void handleRERR(const ParsedPacket &pkt);
     void refreshAODVTable();
 
-    void printRoutingTable();
+    void sendHello();
+    void handleHello(const ParsedPacket &pkt);
+    void refreshNeighbors();
+    int linkMetric(const String &neighbor);
+
+    void startTraffic(const String &dests, unsigned long interval, int size,
+                      uint8_t pattern = TRAFFIC_CONSTANT, int burst = 1);
+    void serviceTraffic();
+    void printTraffic();
+    void resetTrafficSink();
+
+    void setCapture(bool rx, bool tx) { captureRx = rx; captureTx = tx; }
+    void captureFrame(const uint8_t *frame, int len, uint8_t flags, int rssi, float snr,
+                      long freq_error, unsigned long timestamp_us);
+    void sniff(int packetSize, unsigned long irqMicros = 0);
+
+    bool setKey(const uint8_t *key);  // nullptr turns encryption off
+    bool isSecured() const { return cipher.hasKey(); }
+
+    bool sendTrace(const String &dest);
+    void setTraceInterval(const String &dest, unsigned long ms);  // 0 stops
+    void serviceTrace();
+
+    unsigned long meshTime() const { return meshTime(millis()); }
+    unsigned long meshTime(unsigned long local) const;
+    bool isTimeSynced() const;
+
+    unsigned long airtimeMs(int payloadBytes) const;
+
+    void printRoutingTable() { router->printTable(); }
+    void printAODVTable();
+    void printNeighborTable();
+    void printStats();
+    void printMemory();
 
     // === NEW helper accessors ===
-    ParsedPacket getLastReceivedPacket() const { return received_packet; }
+    const ParsedPacket &getLastReceivedPacket() const { return received_packet; }
     void clearLastReceivedPacket() { received_packet.valid = false; }
 
     String getAddress() const { return address; }
+    const NodeStats &getStats() const { return stats; }
 
 private:
     String address;
@@ -83,13 +737,137 @@ private:
 
     int pin_sck, pin_miso, pin_mosi, pin_ss, pin_rst, pin_dio0;
 
-    ParsedPacket received_packet;
+    ParsedPacket received_packet;      // fields reserved in begin(), reused for every frame
+    FramePool frames;
+
+    AodvRouting aodv{*this};
+    FloodRouting flood{*this};
+    CollectionRouting collect{*this};
+    RoutingEngine *router;
 
     std::map<String, RouteEntry> routing_table;
-    std::map<String, int> seen_broadcasts;
+    SeenRREQ seen_broadcasts[RREQ_SEEN_CACHE]; // ring; a flood is over long before its slot is reused
+    int seenBroadcastNext = 0;
+    std::map<String, NeighborEntry> neighbor_table;
+    std::map<String, unsigned long> pending_repairs;  // dest -> give-up time
+    std::map<String, std::vector<String>> rrep_forwarded;  // reverse hops used per discovery
     int broadcastCounter = 0;
+    unsigned long sequenceNumber = 0;
+    unsigned long helloCounter = 0;
+    unsigned long helloInterval = HELLO_INTERVAL_MIN;
+    unsigned long nextHelloTime = 0;
+    unsigned long lastTxTime = 0;
+    unsigned long lastHelloTime = 0;            // last beacon slot, sent or suppressed
+    int suppressedHellos = 0;
+    int lastRxLength = 0;
+    NodeStats stats = {};
+    bool loadBalance = false;
+    bool hopAcks = true;
+    bool routeLearning = true;
+    bool gratuitousRREP = true;
+    bool adaptivePower = TX_POWER_ADAPTIVE;
+    int txPower = TX_POWER_MAX;        // level the radio is currently set to
+    long baseFrequency = 915E6;
+    int channelCount = MC_CHANNELS;
+    int homeChannel = 0;               // data channel we listen on, 0 when single-channel
+    int radioChannel = 0;              // channel the radio is tuned to
+    unsigned long lastTxDue = 0;       // when the last sendMessage() frame goes on air
+    std::vector<DeferredFrame> deferred;
+    int lastTxLength = 0;
+    unsigned long lastDataId = 0;
+    std::vector<PendingFrame> ack_queue;
+    std::vector<String> recent_data;   // origin:message_id ring for duplicate detection
+    size_t recentDataIndex = 0;
+    OutgoingMessage outgoing[FRAG_TX_SLOTS] = {};
+    ReassemblySlot reassembly[REASSEMBLY_SLOTS] = {};
+    BulkSender bulkTx = {};
+    BulkReceiver bulkRx = {};
+
+    TrafficGenerator traffic = {};
+    std::map<String, TrafficSource> traffic_sources;
+    std::vector<long> traffic_latency;  // ring of recent end-to-end latencies
+    size_t trafficLatencyIndex = 0;
+
+    bool captureRx = false;
+    bool captureTx = false;
+
+    FrameCipher cipher;
+    uint32_t txSeq = 0;
+    uint32_t txSeqReserved = 0;                  // first seq not yet claimed in flash
+    std::map<uint64_t, ReplayWindow> replay_windows;  // keyed by packed sender address
+
+    String traceDest;
+    unsigned long traceCounter = 0;
+    unsigned long traceSentAt = 0;
+    unsigned long traceInterval = 0;
+    unsigned long nextTraceTime = 0;
+
+    String syncRoot;                    // lowest address we take time from; us when root
+    unsigned long syncRound = 0;        // root's beacon round we last accepted
+    unsigned long beaconRound = 0;      // round our last HELLO carried
+    unsigned long lastSyncTime = 0;
+    bool meshClockSet = false;         // synced to a root at least once since boot
+    unsigned long syncLocal[TIME_SYNC_SAMPLES] = {};
+    long syncOffset[TIME_SYNC_SAMPLES] = {};
+    int syncCount = 0;
+    int syncIndex = 0;
+    long clockOffset = 0;               // mesh = local + offset + skew * (local - anchor)
+    float clockSkew = 0;
+    unsigned long clockAnchor = 0;
 
-    void parseRawPacket(String raw, ParsedPacket &pkt);
+    void updateNeighbor(const ParsedPacket &pkt);
+    bool sendRoutedAODV(const String &dest, const String &channel, const String &message, bool ack);
+    void dispatchReceived(const FrameHeader &hdr);
+    String forwardedBody(const ParsedPacket &pkt, const FrameHeader &hdr) const;
+    void deliverRouted(ParsedPacket &pkt, const FrameHeader &hdr);
+    int secureOverhead() const;
+    void sealFrame(Frame &frame);
+    bool openFrame(Frame &frame);
+    void reserveSeq();
+    float snrToDeliveryRatio(float snr) const;
+    float linkMargin(int rssi, float snr) const;
+    int txPowerFor(const String &neighbor);
+    void adjustPower(const String &neighbor, int delta);
+    bool multiChannel() const;
+    int announcedChannel() const;
+    int listenChannel() const;
+    int txChannel(const ParsedPacket &pkt, unsigned long airtime, unsigned long &wait);
+    void tuneRadio(int channel);
+    void deferFrame(const ParsedPacket &pkt, unsigned long wait, unsigned long airtime);
+    void pickHomeChannel();
+    bool isBetterRoute(const String &dest, unsigned long seq, int metric);
+    bool learnRoute(const String &dest, unsigned long seq, const PathEntry &path);
+    bool learnOverheard(const String &dest, unsigned long seq, const PathEntry &path);
+    unsigned long knownSeq(const String &dest) const;
+    void installRoute(const String &dest, unsigned long seq, const PathEntry &path);
+    bool addAlternate(const String &dest, unsigned long seq, const PathEntry &path);
+    bool promoteAlternate(RouteEntry &route, const String &lost_hop);
+    const String &selectNextHop(RouteEntry &route);
+    void broadcastRREQ(const RREQPacket &rreq);
+    void answerFromCache(const RREQPacket &rreq, bool gratuitous);
+    void queueFrame(const ParsedPacket &pkt, const String &origin,
+                    const String &payload, const String &next_hop);
+    void transmitPending(PendingFrame &frame);
+    bool confirmPending(const String &from, const String &origin, const String &message_id);
+    int framesInFlight(const String &next_hop) const;
+    bool isDuplicate(const String &key);
+    bool handleFragment(ParsedPacket &pkt, const String &origin, const char *payload, int len);
+    void handleFragmentStatus(const String &origin, const char *payload);
+    void sendFragmentStatus(ReassemblySlot &slot);
+    void sendBulkFrame(bool source, int index, bool ackRequest);
+    bool handleBulkFrame(ParsedPacket &pkt, const String &origin, const char *payload, int len);
+    void handleBulkAck(const String &origin, const char *payload);
+    void sendBulkAck(uint16_t window);
+    void observeTraffic(const ParsedPacket &pkt);
+    void appendTraceHop(String &record, const ParsedPacket &pkt) const;
+    void handleTraceReply(const String &origin, const String &record);
+    String syncBeacon();
+    void handleSyncBeacon(const ParsedPacket &pkt, const String &beacon);
+    void addSyncSample(unsigned long local, unsigned long global);
+    void checkTimeSync();
+    void insertBulkRow(uint32_t mask, uint8_t *data);
+    void addPrecursor(const String &dest, const String &precursor);
+    std::vector<String> precursorsOf(const std::vector<String> &dests);
 };
 
 #endif
@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include "radio.h"
+
+// ================== SNIFFER BUILD ==================
+// Passive capture node (pio run -e sniffer). Every frame heard goes out on
+// the serial port as a binary capture record; nothing is parsed, routed or
+// transmitted. Convert the stream with tools/capture2pcap.py.
+
+#ifndef SNIFFER_SF
+#define SNIFFER_SF 7
+#endif
+
+#ifndef SNIFFER_BAUD
+#define SNIFFER_BAUD 921600
+#endif
+
+LoRaNode node("00", SNIFFER_SF);
+
+// ================== ISR FLAGS ==================
+volatile bool hasLoRaPacket = false;
+volatile int lastPacketSize = 0;
+volatile unsigned long lastPacketMicros = 0;
+
+void IRAM_ATTR onLoRaEvent(int packetSize) {
+    lastPacketMicros = micros();
+    lastPacketSize = packetSize;
+    hasLoRaPacket = true;
+}
+
+// ================== SETUP ==================
+void setup() {
+    Serial.begin(SNIFFER_BAUD);
+    while (!Serial) {}
+
+    if (!node.begin()) {
+        Serial.println("LoRa init failed!");
+        while (1);
+    }
+
+    LoRa.onReceive(onLoRaEvent);
+    LoRa.receive();
+}
+
+// ================== MAIN LOOP ==================
+void loop() {
+    if (!hasLoRaPacket) return;
+    hasLoRaPacket = false;
+    node.sniff(lastPacketSize, lastPacketMicros);
+    LoRa.receive();
+}
@@ -0,0 +1,122 @@
+// FrameCipher against the RFC 3610 AES-CCM packet vectors #1-#3 (M = 8,
+// L = 2), plus tamper checks. Runs on the host with the portable AES:
+//   pio test -e native
+// The env builds src/crypto.cpp with CRYPTO_TAG_LEN=8 to match the vectors.
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "crypto.h"
+
+// crypto.cpp's benchmark prints; the host test has no serial port.
+HardwareSerial Serial;
+size_t HardwareSerial::write(uint8_t) { return 1; }
+int HardwareSerial::available() { return 0; }
+int HardwareSerial::read() { return -1; }
+int HardwareSerial::peek() { return -1; }
+unsigned long micros() { return 0; }
+unsigned long millis() { return 0; }
+
+struct CcmVector {
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    size_t len;                        // payload after the 8 bytes of AAD
+    const char *expected;              // ciphertext || tag, hex
+};
+
+static const uint8_t KEY[CRYPTO_KEY_LEN] = {
+    0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF,
+};
+
+static const CcmVector VECTORS[] = {
+    {{0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5}, 23,
+     "588c979a61c663d2f066d0c2c0f989806d5f6b61dac38417e8d12cfdf926e0"},
+    {{0x00, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5}, 24,
+     "72c91a36e135f8cf291ca894085c87e3cc15c439c9e43a3ba091d56e10400916"},
+    {{0x00, 0x00, 0x00, 0x05, 0x04, 0x03, 0x02, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5}, 25,
+     "51b1e5f44a197d1da46b0f8e2d282ae871e838bb64da8596574adaa76fbd9fb0c5"},
+};
+
+#define AAD_LEN 8
+
+static void fromHex(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], 0};
+        out[i] = strtoul(byte, nullptr, 16);
+    }
+}
+
+// RFC 3610 packets are bytes 00, 01, 02, ...; the first 8 are the AAD.
+static void packet(uint8_t *aad, uint8_t *payload, size_t len) {
+    for (int i = 0; i < AAD_LEN; i++) aad[i] = i;
+    for (size_t i = 0; i < len; i++) payload[i] = AAD_LEN + i;
+}
+
+static FrameCipher cipher;
+
+void setUp() { cipher.setKey(KEY); }
+void tearDown() {}
+
+static void test_seal_matches_rfc3610() {
+    for (const CcmVector &v : VECTORS) {
+        uint8_t aad[AAD_LEN], buf[32], tag[CRYPTO_TAG_LEN], expected[32 + CRYPTO_TAG_LEN];
+        packet(aad, buf, v.len);
+        fromHex(v.expected, expected, v.len + CRYPTO_TAG_LEN);
+
+        cipher.seal(v.nonce, aad, AAD_LEN, buf, v.len, tag);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buf, v.len);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected + v.len, tag, CRYPTO_TAG_LEN);
+    }
+}
+
+static void test_open_recovers_rfc3610_plaintext() {
+    for (const CcmVector &v : VECTORS) {
+        uint8_t aad[AAD_LEN], plain[32], buf[32 + CRYPTO_TAG_LEN];
+        packet(aad, plain, v.len);
+        fromHex(v.expected, buf, v.len + CRYPTO_TAG_LEN);
+
+        TEST_ASSERT_TRUE(cipher.open(v.nonce, aad, AAD_LEN, buf, v.len, buf + v.len));
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(plain, buf, v.len);
+    }
+}
+
+static void test_open_rejects_tampered_tag() {
+    const CcmVector &v = VECTORS[0];
+    for (int bit = 0; bit < CRYPTO_TAG_LEN * 8; bit++) {
+        uint8_t aad[AAD_LEN], plain[32], buf[32 + CRYPTO_TAG_LEN];
+        packet(aad, plain, v.len);
+        fromHex(v.expected, buf, v.len + CRYPTO_TAG_LEN);
+        buf[v.len + bit / 8] ^= 1 << (bit % 8);
+        TEST_ASSERT_FALSE(cipher.open(v.nonce, aad, AAD_LEN, buf, v.len, buf + v.len));
+    }
+}
+
+static void test_open_rejects_tampered_ciphertext_and_aad() {
+    const CcmVector &v = VECTORS[1];
+    uint8_t aad[AAD_LEN], plain[32], buf[32 + CRYPTO_TAG_LEN];
+
+    packet(aad, plain, v.len);
+    fromHex(v.expected, buf, v.len + CRYPTO_TAG_LEN);
+    buf[5] ^= 0x01;
+    TEST_ASSERT_FALSE(cipher.open(v.nonce, aad, AAD_LEN, buf, v.len, buf + v.len));
+
+    packet(aad, plain, v.len);
+    fromHex(v.expected, buf, v.len + CRYPTO_TAG_LEN);
+    aad[0] ^= 0x80;
+    TEST_ASSERT_FALSE(cipher.open(v.nonce, aad, AAD_LEN, buf, v.len, buf + v.len));
+
+    packet(aad, plain, v.len);
+    fromHex(v.expected, buf, v.len + CRYPTO_TAG_LEN);
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    memcpy(nonce, v.nonce, CRYPTO_NONCE_LEN);
+    nonce[12] ^= 0x01;
+    TEST_ASSERT_FALSE(cipher.open(nonce, aad, AAD_LEN, buf, v.len, buf + v.len));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_seal_matches_rfc3610);
+    RUN_TEST(test_open_recovers_rfc3610_plaintext);
+    RUN_TEST(test_open_rejects_tampered_tag);
+    RUN_TEST(test_open_rejects_tampered_ciphertext_and_aad);
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Convert a LoRa node's binary capture stream into a pcap file.
+
+The stream comes from the sniffer build (pio run -e sniffer) or from a node
+running "!capture rx" / "!capture all". It may be a serial port (needs
+pyserial) or a file saved from one. Text log lines in between are skipped.
+
+Each pcap packet is the 16-byte capture meta header followed by the raw
+frame, with link type USER0 (147). Load tools/hoppy.lua in Wireshark to
+decode it.
+
+    capture2pcap.py /dev/ttyUSB0 -o mesh.pcap
+    capture2pcap.py saved.bin -o mesh.pcap
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = b"LCAP"
+META_LEN = 16
+LINKTYPE_USER0 = 147
+SNAPLEN = 65535
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def open_input(path, baud):
+    if path == "-":
+        return sys.stdin.buffer, False
+    if path.startswith("/dev/") or path.upper().startswith("COM"):
+        import serial  # pyserial, only needed for live capture
+        return serial.Serial(path, baud, timeout=0.1), True
+    return open(path, "rb"), False
+
+
+def records(stream, live):
+    """Yields (meta, frame) for every record whose CRC checks out."""
+    buf = b""
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            if live:
+                continue
+            return
+        buf += chunk
+        while True:
+            start = buf.find(MAGIC)
+            if start < 0:
+                buf = buf[-(len(MAGIC) - 1):]
+                break
+            head_end = start + len(MAGIC) + 2 + META_LEN
+            if len(buf) < head_end:
+                buf = buf[start:]
+                break
+            (length,) = struct.unpack_from("<H", buf, start + len(MAGIC))
+            end = head_end + length + 2
+            if length > 255:
+                buf = buf[start + 1:]
+                continue
+            if len(buf) < end:
+                buf = buf[start:]
+                break
+            body = buf[start + len(MAGIC):end - 2]
+            (crc,) = struct.unpack_from("<H", buf, end - 2)
+            if crc16_ccitt(body) != crc:
+                buf = buf[start + 1:]
+                continue
+            yield body[2:2 + META_LEN], body[2 + META_LEN:]
+            buf = buf[end:]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", help="serial port, capture file, or - for stdin")
+    ap.add_argument("-o", "--output", required=True, help="pcap file to write")
+    ap.add_argument("-b", "--baud", type=int, default=921600, help="serial baud rate (default 921600)")
+    args = ap.parse_args()
+
+    stream, live = open_input(args.input, args.baud)
+    out = open(args.output, "wb")
+    out.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, SNAPLEN, LINKTYPE_USER0))
+
+    # Device timestamps are a wrapping 32-bit micros() counter; anchor them to
+    # the host clock at the first record and unwrap from there.
+    base_host = None
+    last_us = 0
+    elapsed_us = 0
+    count = 0
+    try:
+        for meta, frame in records(stream, live):
+            (ts_us,) = struct.unpack_from("<I", meta, 12)
+            if base_host is None:
+                base_host = time.time()
+            else:
+                elapsed_us += (ts_us - last_us) & 0xFFFFFFFF
+            last_us = ts_us
+
+            when = base_host + elapsed_us / 1e6
+            data = meta + frame
+            out.write(struct.pack("<IIII", int(when), int((when % 1) * 1e6), len(data), len(data)))
+            out.write(data)
+            count += 1
+            if live:
+                out.flush()
+                print("\r%d frames" % count, end="", file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        out.close()
+    print("\nwrote %d frames to %s" % (count, args.output), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,123 @@
+-- Wireshark dissector for LoRa mesh captures written by tools/capture2pcap.py.
+-- Install: copy to your Wireshark personal plugins folder, or run
+--   wireshark -X lua_script:tools/hoppy.lua mesh.pcap
+-- Packets use link type USER0 (147): a 16-byte capture meta header followed
+-- by the text frame  timestamp||channel||channel_id||sender||message_id||length||is_channel||message
+
+local hoppy = Proto("hoppy", "LoRa Mesh Frame")
+
+local flag_names = { [0] = "RX", [1] = "TX" }
+
+local f = hoppy.fields
+f.version    = ProtoField.uint8("hoppy.meta.version", "Capture version")
+f.flags      = ProtoField.uint8("hoppy.meta.flags", "Flags", base.HEX)
+f.tx         = ProtoField.uint8("hoppy.meta.tx", "Direction", base.DEC, flag_names, 0x01)
+f.crc_err    = ProtoField.bool("hoppy.meta.crc_error", "CRC error", 8, nil, 0x02)
+f.secured    = ProtoField.bool("hoppy.meta.secured", "Encrypted on air", 8, nil, 0x04)
+f.auth_err   = ProtoField.bool("hoppy.meta.auth_error", "Failed authentication", 8, nil, 0x08)
+f.sf         = ProtoField.uint8("hoppy.meta.sf", "Spreading factor")
+f.snr        = ProtoField.float("hoppy.meta.snr", "SNR (dB)")
+f.rssi       = ProtoField.int16("hoppy.meta.rssi", "RSSI (dBm)")
+f.freq_error = ProtoField.int32("hoppy.meta.freq_error", "Frequency error (Hz)")
+f.timestamp  = ProtoField.uint32("hoppy.meta.timestamp_us", "DIO0 timestamp (us)")
+
+f.stamp      = ProtoField.string("hoppy.timestamp", "Timestamp")
+f.channel    = ProtoField.string("hoppy.channel", "Channel")
+f.channel_id = ProtoField.string("hoppy.channel_id", "Channel ID / destination")
+f.sender     = ProtoField.string("hoppy.sender", "Sender")
+f.message_id = ProtoField.string("hoppy.message_id", "Message ID")
+f.length     = ProtoField.string("hoppy.length", "Length")
+f.is_channel = ProtoField.string("hoppy.is_channel", "Is channel")
+f.message    = ProtoField.string("hoppy.message", "Message")
+f.origin     = ProtoField.string("hoppy.origin", "Origin")
+f.next_hop   = ProtoField.string("hoppy.next_hop", "Next hop")
+f.ack        = ProtoField.string("hoppy.ack", "ACK requested")
+f.hops_left  = ProtoField.string("hoppy.hops_left", "Hops left")
+f.payload    = ProtoField.string("hoppy.payload", "Payload")
+
+local header_fields = { f.stamp, f.channel, f.channel_id, f.sender, f.message_id, f.length, f.is_channel }
+
+-- Channels whose message starts with origin||next_hop||ack||. Flooded frames
+-- have next_hop FF and carry the remaining hop budget in the ack slot; channel
+-- messages (is_channel 1, any channel but the mesh control ones) are flooded.
+local routed = { DATA = true, FRAG = true, FSTAT = true, BULK = true, BACK = true, TRACE = true, TRACR = true }
+local control = { RREQ = true, RREP = true, RERR = true, HELLO = true, ACK = true, TREE = true }
+
+-- Splits off up to n "||"-separated fields; returns {offset, length} pairs,
+-- the last one covering the rest of the text.
+local function split(text, base, n)
+    local parts, pos = {}, 1
+    for _ = 1, n do
+        local s = text:find("||", pos, true)
+        if not s then break end
+        parts[#parts + 1] = { base + pos - 1, s - pos }
+        pos = s + 2
+    end
+    parts[#parts + 1] = { base + pos - 1, #text - pos + 1 }
+    return parts
+end
+
+function hoppy.dissector(buf, pinfo, tree)
+    if buf:len() < 16 then return 0 end
+    pinfo.cols.protocol = "HOPPY"
+
+    local t = tree:add(hoppy, buf(), "LoRa Mesh Frame")
+    local meta = t:add(buf(0, 16), "Capture metadata")
+    meta:add(f.version, buf(0, 1))
+    local flags = meta:add(f.flags, buf(1, 1))
+    flags:add(f.tx, buf(1, 1))
+    flags:add(f.crc_err, buf(1, 1))
+    flags:add(f.secured, buf(1, 1))
+    flags:add(f.auth_err, buf(1, 1))
+    meta:add(f.sf, buf(2, 1))
+    meta:add(f.snr, buf(3, 1), buf(3, 1):int() / 4)
+    meta:add_le(f.rssi, buf(4, 2))
+    meta:add_le(f.freq_error, buf(8, 4))
+    meta:add_le(f.timestamp, buf(12, 4))
+
+    if bit.band(buf(1, 1):uint(), 0x08) ~= 0 then
+        t:add(f.message, buf(16))
+        pinfo.cols.info = "Secured frame, failed authentication"
+        return buf:len()
+    end
+
+    local frame = buf(16)
+    local text = frame:string()
+    local parts = split(text, 16, 7)
+    if #parts < 8 then
+        t:add(f.message, frame)
+        pinfo.cols.info = "Malformed frame"
+        return buf:len()
+    end
+
+    local values = {}
+    for i = 1, 8 do
+        local off, len = parts[i][1], parts[i][2]
+        values[i] = buf(off, len):string()
+        t:add(i <= 7 and header_fields[i] or f.message, buf(off, math.max(len, 0)))
+    end
+
+    local channel, dest, sender = values[2], values[3], values[4]
+    local info = channel .. " " .. sender .. " -> " .. dest
+
+    if routed[channel] or (values[7] == "1" and not control[channel]) then
+        local msg_off = parts[8][1]
+        local body = split(values[8], msg_off, 3)
+        if #body == 4 then
+            local r = t:add(buf(msg_off, parts[8][2]), "Routed header")
+            r:add(f.origin, buf(body[1][1], body[1][2]))
+            r:add(f.next_hop, buf(body[2][1], body[2][2]))
+            local flooded = buf(body[2][1], body[2][2]):string() == "FF"
+            r:add(flooded and f.hops_left or f.ack, buf(body[3][1], body[3][2]))
+            r:add(f.payload, buf(body[4][1], math.max(body[4][2], 0)))
+            info = info .. " (origin " .. buf(body[1][1], body[1][2]):string() ..
+                   ", via " .. buf(body[2][1], body[2][2]):string() .. ")"
+        end
+    end
+
+    if buf(1, 1):uint() % 2 == 1 then info = "TX " .. info end
+    pinfo.cols.info = info
+    return buf:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, hoppy)
@@ -0,0 +1,363 @@
+// ================== TRACE REPLAY HARNESS ==================
+// Runs the unmodified node firmware (src/main.cpp + src/radio.cpp) on Linux
+// against a recorded trace, in virtual time. The clock only advances between
+// events, by --tick per loop() pass and by the airtime of every transmitted
+// frame, so hours of field traffic replay in seconds. The output is
+// deterministic for a given trace and seed, so two firmware versions can be
+// diffed line by line.
+//
+// Build:  pio run -e replay
+//    or:  g++ -std=gnu++17 -O2 -Itools/replay/shim -o replay
+//             src/main.cpp src/radio.cpp src/crypto.cpp src/heapGuard.cpp
+//             tools/replay/replay.cpp
+//    Add -DHEAP_GUARD [-DHEAP_GUARD_STRICT] to run the allocation guard.
+//
+// Usage:  replay [--tick ms] [--tail ms] [--seed n] [--heap-every ms] [--quiet] trace...
+//
+// Text trace lines (times in ms from the start of the replay):
+//   <ms> RX <rssi> <snr> <frame>    a frame heard on air, as raw text
+//   <ms> RXHEX <rssi> <snr> <hex>   the same as hex bytes, e.g. a secured frame
+//   <ms> SER <line>                 a line arriving on the serial port
+//   # comment
+// A .pcap written by tools/capture2pcap.py is accepted as well; its RX
+// records are replayed relative to the first one, TX records are skipped.
+// Several inputs are merged by time. Transmitted frames are printed after
+// ">>", as hex when they are not plain text.
+//
+// tools/replay/run_tests.sh replays the traces in tools/replay/tests and
+// diffs the output against the .expected file next to each one.
+
+#include <Arduino.h>
+#include <LoRa.h>
+#include <malloc.h>
+
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#include "heapGuard.h"
+#include "radio.h"
+
+extern LoRaNode node;   // src/main.cpp
+void setup();
+void loop();
+
+// ================== VIRTUAL CLOCK ==================
+static unsigned long long nowUs = 0;
+static uint32_t rngState = 1;
+
+unsigned long millis() { return (unsigned long)(nowUs / 1000); }
+unsigned long micros() { return (unsigned long)nowUs; }
+void delay(unsigned long ms) { nowUs += ms * 1000ULL; }
+
+// xorshift32 keeps random() identical across hosts and libc versions.
+static uint32_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+long random(long howbig) { return howbig > 0 ? nextRandom() % howbig : 0; }
+long random(long howsmall, long howbig) { return howbig > howsmall ? howsmall + random(howbig - howsmall) : howsmall; }
+void randomSeed(unsigned long seed) { rngState = seed ? seed : 1; }
+
+// ================== HEAP ACCOUNTING ==================
+// Counted from setup() on, so the loaded trace itself does not show up.
+static bool heapTracking = false;
+
+struct HeapStats {
+    size_t live;
+    size_t peak;
+    unsigned long allocations;
+};
+static HeapStats heap = {};
+
+void *operator new(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    if (!heapTracking) return p;
+#ifdef HEAP_GUARD
+    heapGuardOnAlloc(size);
+#endif
+    heap.live += malloc_usable_size(p);
+    heap.peak = std::max(heap.peak, heap.live);
+    heap.allocations++;
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    if (!p) return;
+    if (heapTracking) heap.live -= malloc_usable_size(p);
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+// ================== SERIAL ==================
+// Output is split into lines, each prefixed with the virtual time. The line
+// and TX buffers are reserved up front so that writes from a HEAP_FREE_SCOPE
+// do not allocate in the harness and trip a -DHEAP_GUARD build.
+#define SERIAL_LINE_RESERVE 4096
+HardwareSerial Serial;
+static std::string serialIn;
+static size_t serialInPos = 0;
+static std::string serialLine;
+static bool quiet = false;
+static unsigned long serialLinesOut = 0;
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (c == '\n') {
+        serialLinesOut++;
+        if (!quiet) printf("%10lu  %s\n", millis(), serialLine.c_str());
+        serialLine.clear();
+    } else if (c != '\r') {
+        serialLine += (char)c;
+    }
+    return 1;
+}
+
+int HardwareSerial::available() { return serialIn.size() - serialInPos; }
+int HardwareSerial::read() { return serialInPos < serialIn.size() ? (uint8_t)serialIn[serialInPos++] : -1; }
+int HardwareSerial::peek() { return serialInPos < serialIn.size() ? (uint8_t)serialIn[serialInPos] : -1; }
+
+// ================== RADIO ==================
+// Transmissions block for their airtime, like LoRa.endPacket() on hardware.
+SPIClass SPI;
+LoRaClass LoRa;
+static std::string txFrame;
+static std::string rxFrame;
+static size_t rxPos = 0;
+static int rxRssi = 0;
+static float rxSnr = 0;
+static unsigned long framesOut = 0;
+static unsigned long long airtimeOutMs = 0;
+
+int LoRaClass::begin(long) { return 1; }
+int LoRaClass::beginPacket(int) { txFrame.clear(); return 1; }
+
+// Straight to stdout: this runs inside the firmware's heap-free TX scope.
+static void printTxFrame() {
+    bool text = true;
+    for (unsigned char c : txFrame) text &= c >= 0x20 && c < 0x7F;
+    printf("%10lu  >> %s", millis(), text ? txFrame.c_str() : "hex ");
+    if (!text) {
+        for (unsigned char c : txFrame) printf("%02x", c);
+    }
+    printf("\n");
+}
+
+int LoRaClass::endPacket(bool) {
+    unsigned long airtime = node.airtimeMs(txFrame.size());
+    framesOut++;
+    airtimeOutMs += airtime;
+    if (!quiet) printTxFrame();
+    nowUs += airtime * 1000ULL;
+    return 1;
+}
+
+int LoRaClass::packetRssi() { return rxRssi; }
+float LoRaClass::packetSnr() { return rxSnr; }
+long LoRaClass::packetFrequencyError() { return 0; }
+size_t LoRaClass::write(uint8_t c) { txFrame += (char)c; return 1; }
+size_t LoRaClass::write(const uint8_t *buf, size_t size) { txFrame.append((const char *)buf, size); return size; }
+int LoRaClass::available() { return rxFrame.size() - rxPos; }
+int LoRaClass::read() { return rxPos < rxFrame.size() ? (uint8_t)rxFrame[rxPos++] : -1; }
+int LoRaClass::peek() { return rxPos < rxFrame.size() ? (uint8_t)rxFrame[rxPos] : -1; }
+
+// ================== TRACE LOADING ==================
+struct TraceEvent {
+    unsigned long long time_us;
+    bool serial;            // serial line, otherwise an RX frame
+    int rssi;
+    float snr;
+    std::string data;
+};
+
+static bool decodeHex(std::string &data) {
+    if (data.size() % 2) return false;
+    std::string bytes;
+    for (size_t i = 0; i < data.size(); i += 2) {
+        char byte[3] = {data[i], data[i + 1], 0};
+        char *end;
+        bytes += (char)strtoul(byte, &end, 16);
+        if (*end) return false;
+    }
+    data = bytes;
+    return true;
+}
+
+static bool loadText(const char *path, std::vector<TraceEvent> &events) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        char kind[8] = {0};
+        unsigned long long ms = 0;
+        int consumed = 0;
+        if (sscanf(line.c_str(), "%llu %7s %n", &ms, kind, &consumed) < 2) {
+            fprintf(stderr, "%s:%d: unreadable line\n", path, lineNo);
+            continue;
+        }
+        TraceEvent ev = {ms * 1000ULL, false, 0, 0, ""};
+        if (strcmp(kind, "SER") == 0) {
+            ev.serial = true;
+            ev.data = line.substr(consumed) + "\n";
+        } else if (strcmp(kind, "RX") == 0 || strcmp(kind, "RXHEX") == 0) {
+            int rest = 0;
+            if (sscanf(line.c_str() + consumed, "%d %f %n", &ev.rssi, &ev.snr, &rest) < 2) {
+                fprintf(stderr, "%s:%d: %s needs rssi and snr\n", path, lineNo, kind);
+                continue;
+            }
+            ev.data = line.substr(consumed + rest);
+            if (strcmp(kind, "RXHEX") == 0 && !decodeHex(ev.data)) {
+                fprintf(stderr, "%s:%d: bad hex frame\n", path, lineNo);
+                continue;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: unknown event %s\n", path, lineNo, kind);
+            continue;
+        }
+        events.push_back(ev);
+    }
+    return true;
+}
+
+// pcap from tools/capture2pcap.py: 16-byte capture meta header + frame.
+static bool loadPcap(const char *path, std::vector<TraceEvent> &events) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    uint32_t header[6];
+    if (fread(header, sizeof(header), 1, f) != 1 || header[0] != 0xA1B2C3D4) {
+        fclose(f);
+        return false;
+    }
+
+    bool first = true;
+    unsigned long long base_us = 0;
+    uint32_t rec[4];
+    std::vector<uint8_t> data;
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        data.resize(rec[2]);
+        if (rec[2] && fread(data.data(), rec[2], 1, f) != 1) break;
+        if (rec[2] < CAPTURE_META_LEN || (data[1] & CAPTURE_FLAG_TX)) continue;
+
+        unsigned long long t = rec[0] * 1000000ULL + rec[1];
+        if (first) base_us = t;
+        first = false;
+        TraceEvent ev;
+        ev.time_us = t - base_us;
+        ev.serial = false;
+        ev.snr = (int8_t)data[3] / 4.0f;
+        ev.rssi = (int16_t)(data[4] | (data[5] << 8));
+        ev.data.assign((const char *)data.data() + CAPTURE_META_LEN, rec[2] - CAPTURE_META_LEN);
+        events.push_back(ev);
+    }
+    fclose(f);
+    return true;
+}
+
+// ================== MAIN ==================
+static void inject(const TraceEvent &ev) {
+    if (ev.serial) {
+        serialIn.erase(0, serialInPos);
+        serialInPos = 0;
+        serialIn += ev.data;
+        return;
+    }
+    rxFrame = ev.data;
+    rxPos = 0;
+    rxRssi = ev.rssi;
+    rxSnr = ev.snr;
+    if (LoRa._onReceive) LoRa._onReceive(rxFrame.size());
+}
+
+static void printSummary(unsigned long rxIn, unsigned long serialIn) {
+    Serial.println("\n[DBG]========== REPLAY SUMMARY ==========");
+    Serial.println("[DBG]Virtual time: " + String(millis()) + " ms" +
+                   " | RX frames in: " + String(rxIn) +
+                   " | Serial lines in: " + String(serialIn));
+    Serial.println("[DBG]TX frames: " + String(framesOut) +
+                   " | TX airtime: " + String((unsigned long)airtimeOutMs) + " ms" +
+                   " | Serial lines out: " + String(serialLinesOut));
+    Serial.println("[DBG]Heap live: " + String((unsigned long)heap.live) + " B" +
+                   " | peak: " + String((unsigned long)heap.peak) + " B" +
+                   " | allocations: " + String(heap.allocations));
+    Serial.println("[DBG]=====================================================");
+    node.printStats();
+    node.printRoutingTable();
+    node.printNeighborTable();
+}
+
+int main(int argc, char **argv) {
+    unsigned long tickMs = 5;
+    unsigned long tailMs = 10000;
+    unsigned long heapEveryMs = 0;
+    std::vector<TraceEvent> events;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--tick" && i + 1 < argc) {
+            tickMs = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--tail" && i + 1 < argc) {
+            tailMs = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            randomSeed(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--heap-every" && i + 1 < argc) {
+            heapEveryMs = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else if (!loadPcap(argv[i], events) && !loadText(argv[i], events)) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (events.empty()) {
+        fprintf(stderr, "usage: %s [--tick ms] [--tail ms] [--seed n] [--heap-every ms] [--quiet] trace...\n", argv[0]);
+        return 1;
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const TraceEvent &a, const TraceEvent &b) { return a.time_us < b.time_us; });
+
+    auto wallStart = std::chrono::steady_clock::now();
+    serialLine.reserve(SERIAL_LINE_RESERVE);
+    txFrame.reserve(MAX_FRAME_LENGTH + 1);
+    heapTracking = true;
+    setup();
+
+    unsigned long long endUs = events.back().time_us + tailMs * 1000ULL;
+    unsigned long long nextHeapUs = heapEveryMs * 1000ULL;
+    unsigned long rxIn = 0, serialLinesIn = 0;
+    size_t next = 0;
+    while (nowUs <= endUs) {
+        while (next < events.size() && events[next].time_us <= nowUs) {
+            const TraceEvent &ev = events[next++];
+            ev.serial ? serialLinesIn++ : rxIn++;
+            inject(ev);
+            loop();
+        }
+        loop();
+
+        if (heapEveryMs && nowUs >= nextHeapUs) {
+            printf("%10lu  [HEAP] live=%zu peak=%zu\n", millis(), heap.live, heap.peak);
+            nextHeapUs += heapEveryMs * 1000ULL;
+        }
+
+        unsigned long long step = nowUs + tickMs * 1000ULL;
+        if (next < events.size() && events[next].time_us < step && events[next].time_us > nowUs) step = events[next].time_us;
+        nowUs = step;
+    }
+
+    quiet = false;
+    printSummary(rxIn, serialLinesIn);
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    fprintf(stderr, "replayed %.1f s of virtual time in %.2f s wall (%.0fx)\n",
+            nowUs / 1e6, wall, wall > 0 ? nowUs / 1e6 / wall : 0.0);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Replay regression traces: builds the harness, replays every
+# tools/replay/tests/*.trace and diffs the output against the .expected file
+# next to it. A trace can pass extra replay options on a "# args:" line.
+# Colour codes are stripped, and so is the heap summary line, which depends on
+# the host's malloc.
+#
+# Usage:  tools/replay/run_tests.sh [--update] [name...]
+#   --update rewrites the .expected files from the current firmware.
+# REPLAY_CFLAGS adds compiler flags, e.g. "-DHEAP_GUARD -DHEAP_GUARD_STRICT"
+# to abort on any allocation inside a HEAP_FREE_SCOPE.
+
+set -u
+cd "$(dirname "$0")/../.."
+
+update=0
+if [ "${1:-}" = "--update" ]; then
+    update=1
+    shift
+fi
+
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+g++ -std=gnu++17 -O1 -Itools/replay/shim -Isrc ${REPLAY_CFLAGS:-} \
+    src/main.cpp src/radio.cpp src/crypto.cpp src/heapGuard.cpp tools/replay/replay.cpp -o "$build/replay" || exit 1
+
+if [ $# -eq 0 ]; then
+    set -- $(ls tools/replay/tests/*.trace | sed 's|.*/||; s|\.trace$||')
+fi
+
+failed=0
+for name in "$@"; do
+    trace=tools/replay/tests/$name.trace
+    expected=tools/replay/tests/$name.expected
+    args=$(sed -n 's/^# args: *//p' "$trace")
+    "$build/replay" $args "$trace" 2>/dev/null | sed 's/\x1b\[[0-9;]*m//g' | grep -v 'Heap live:' > "$build/out"
+
+    if [ $update -eq 1 ]; then
+        cp "$build/out" "$expected"
+        echo "updated $name"
+    elif diff -u "$expected" "$build/out" > "$build/diff"; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        cat "$build/diff"
+        failed=1
+    fi
+done
+exit $failed
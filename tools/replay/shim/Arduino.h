@@ -0,0 +1,187 @@
+// Minimal Arduino core for building the firmware on a Linux host (replay
+// harness). Only what src/ uses is provided; the clock is virtual and driven
+// by tools/replay/replay.cpp.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define IRAM_ATTR
+#define F(x) x
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+
+class String {
+public:
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(const std::string &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(int v, unsigned char base = 10) { formatSigned(v, base); }
+    String(unsigned v, unsigned char base = 10) { formatUnsigned(v, base); }
+    String(long v, unsigned char base = 10) { formatSigned(v, base); }
+    String(unsigned long v, unsigned char base = 10) { formatUnsigned(v, base); }
+    String(long long v, unsigned char base = 10) { formatSigned((long)v, base); }
+    String(unsigned long long v, unsigned char base = 10) { formatUnsigned((unsigned long)v, base); }
+    String(float v, unsigned char decimals = 2) { formatFloat(v, decimals); }
+    String(double v, unsigned char decimals = 2) { formatFloat(v, decimals); }
+
+    unsigned length() const { return s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    const char *c_str() const { return s.c_str(); }
+    bool reserve(unsigned size) { s.reserve(size); return true; }
+
+    int indexOf(char c, unsigned from = 0) const { return pos(s.find(c, from)); }
+    int indexOf(const String &str, unsigned from = 0) const { return pos(s.find(str.s, from)); }
+    int lastIndexOf(char c) const { return pos(s.rfind(c)); }
+    String substring(unsigned from) const { return from >= s.size() ? String() : String(s.substr(from)); }
+    String substring(unsigned from, unsigned to) const {
+        if (from > to) std::swap(from, to);
+        return from >= s.size() ? String() : String(s.substr(from, to - from));
+    }
+    bool startsWith(const String &prefix) const { return s.compare(0, prefix.s.size(), prefix.s) == 0; }
+    bool endsWith(const String &suffix) const {
+        return s.size() >= suffix.s.size() && s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0;
+    }
+    char charAt(unsigned i) const { return i < s.size() ? s[i] : 0; }
+    char operator[](unsigned i) const { return charAt(i); }
+    void trim() {
+        size_t a = s.find_first_not_of(" \t\r\n");
+        if (a == std::string::npos) { s.clear(); return; }
+        s = s.substr(a, s.find_last_not_of(" \t\r\n") - a + 1);
+    }
+    void remove(unsigned index) { if (index < s.size()) s.erase(index); }
+    void remove(unsigned index, unsigned count) { if (index < s.size()) s.erase(index, count); }
+    void toUpperCase() { for (auto &c : s) c = toupper(c); }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    bool equals(const String &other) const { return s == other.s; }
+    void getBytes(unsigned char *buf, unsigned size, unsigned index = 0) const {
+        if (!size) return;
+        unsigned n = 0;
+        for (; n + 1 < size && index + n < s.size(); n++) buf[n] = s[index + n];
+        buf[n] = 0;
+    }
+
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    String &operator+=(const char *other) { s += other; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    bool concat(const String &other) { s += other.s; return true; }
+    bool concat(char c) { s += c; return true; }
+    bool concat(const char *p, unsigned n) { s.append(p, n); return true; }
+
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator==(const char *other) const { return s == other; }
+    bool operator!=(const String &other) const { return s != other.s; }
+    bool operator!=(const char *other) const { return s != other; }
+    bool operator<(const String &other) const { return s < other.s; }
+    bool operator>(const String &other) const { return s > other.s; }
+
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s); }
+    friend String operator+(const String &a, char b) { return String(a.s + b); }
+    friend String operator+(const String &a, int b) { return a + String(b); }
+    friend String operator+(const String &a, unsigned b) { return a + String(b); }
+    friend String operator+(const String &a, long b) { return a + String(b); }
+    friend String operator+(const String &a, unsigned long b) { return a + String(b); }
+    friend String operator+(const String &a, float b) { return a + String(b); }
+    friend String operator+(const String &a, double b) { return a + String(b); }
+
+private:
+    std::string s;
+
+    static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+    void formatSigned(long v, int base) {
+        if (base == 10) { s = std::to_string(v); return; }
+        formatUnsigned((unsigned long)v, base);
+    }
+    void formatUnsigned(unsigned long v, int base) {
+        char buf[40];
+        snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%lu", v);
+        s = buf;
+    }
+    void formatFloat(double v, unsigned char decimals) {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        s = buf;
+    }
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t n) {
+        for (size_t i = 0; i < n; i++) write(buf[i]);
+        return n;
+    }
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v, int base = 10) { return print(String(v, base)); }
+    size_t print(unsigned v, int base = 10) { return print(String(v, base)); }
+    size_t print(long v, int base = 10) { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = 10) { return print(String(v, base)); }
+    size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+    size_t println() { return print("\n"); }
+    template <class T> size_t println(const T &v) { return print(v) + println(); }
+    template <class T> size_t println(const T &v, int fmt) { return print(v, fmt) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    String readStringUntil(char terminator) {
+        String out;
+        int c;
+        while ((c = read()) >= 0 && c != terminator) out += (char)c;
+        return out;
+    }
+    void setTimeout(unsigned long) {}
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    size_t setRxBufferSize(size_t size) { return size; }
+    size_t setTxBufferSize(size_t size) { return size; }
+    operator bool() const { return true; }
+    size_t write(uint8_t c) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+};
+
+extern HardwareSerial Serial;
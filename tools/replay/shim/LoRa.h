@@ -0,0 +1,47 @@
+// Host stand-in for sandeepmistry/LoRa. Transmitted frames and injected
+// receptions are handled by tools/replay/replay.cpp.
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+class LoRaClass : public Stream {
+public:
+    int begin(long frequency);
+    void end() {}
+
+    int beginPacket(int implicitHeader = false);
+    int endPacket(bool async = false);
+
+    int packetRssi();
+    float packetSnr();
+    long packetFrequencyError();
+    int rssi() { return -120; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    void onReceive(void (*callback)(int)) { _onReceive = callback; }
+    void onTxDone(void (*callback)()) {}
+    void receive(int size = 0) {}
+    void idle() {}
+    void sleep() {}
+
+    void setPins(int ss, int reset, int dio0) {}
+    void setTxPower(int level, int outputPin = 1) {}
+    void setFrequency(long frequency) {}
+    void setSpreadingFactor(int sf) {}
+    void setSignalBandwidth(long sbw) {}
+    void setCodingRate4(int denominator) {}
+    void setPreambleLength(long length) {}
+    void setSyncWord(int sw) {}
+    void enableCrc() {}
+    void disableCrc() {}
+
+    void (*_onReceive)(int) = nullptr;
+};
+
+extern LoRaClass LoRa;
@@ -0,0 +1,11 @@
+// Host stand-in for the Arduino SPI bus; the replay harness has no radio.
+#pragma once
+
+#include <Arduino.h>
+
+class SPIClass {
+public:
+    void begin(int sck = -1, int miso = -1, int mosi = -1, int ss = -1) {}
+};
+
+extern SPIClass SPI;